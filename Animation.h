@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "glm.hpp"
+
+using namespace std;
+using namespace glm;
+
+#ifndef RAYTRACER_ANIMATION_H
+#define RAYTRACER_ANIMATION_H
+
+
+/**
+ * Position of something along the frames, given at key frames and linearly interpolated in between.
+ * Before the first key and after the last one, it stays where they put it.
+ */
+struct Track {
+    vector<pair<float, vec3>> keys;     // Frame and position, sorted by frame
+
+    bool empty() const { return keys.empty(); }
+
+    /**
+     * Add a key, replacing the one at the same frame
+     * @param frame
+     * @param value
+     */
+    void add(float frame, const vec3 &value) {
+        auto at = lower_bound(keys.begin(), keys.end(), frame,
+                              [](const pair<float, vec3> &key, float f) { return key.first < f; });
+        if (at != keys.end() && at->first == frame)
+            at->second = value;
+        else
+            keys.insert(at, make_pair(frame, value));
+    }
+
+    /**
+     * Position at a frame, keys given
+     * @param frame
+     * @return
+     */
+    vec3 at(float frame) const {
+        if (frame <= keys.front().first) return keys.front().second;
+        if (frame >= keys.back().first) return keys.back().second;
+
+        auto next = upper_bound(keys.begin(), keys.end(), frame,
+                                [](float f, const pair<float, vec3> &key) { return f < key.first; });
+        auto previous = next - 1;
+        float s = (frame - previous->first) / (next->first - previous->first);
+        return previous->second + (next->second - previous->second) * s;
+    }
+
+    /**
+     * Frame of the last key, 0 without keys
+     * @return
+     */
+    float end() const { return keys.empty() ? 0 : keys.back().first; }
+};
+
+
+/**
+ * Moving parts of a scene, by index in the arrays of the scene, the rest of it staying still
+ */
+struct Animation {
+    int frames = 0;                         // Frames of the sequence, 0 for a still image
+    Track camera;
+    vector<pair<int, Track>> objects;       // Position of objects of Scene::objs
+    vector<pair<int, Track>> lights;        // Position of lights of Scene::lights
+    vector<pair<int, Track>> instances;     // Translation of mesh instances of Scene::instances
+
+    bool empty() const {
+        return camera.empty() && objects.empty() && lights.empty() && instances.empty();
+    }
+
+    /**
+     * End the sequence with the last key, when the scene file doesn't give its length
+     */
+    void coverKeys() {
+        float last = camera.end();
+        for (const auto &object : objects) last = glm::max(last, object.second.end());
+        for (const auto &light : lights) last = glm::max(last, light.second.end());
+        for (const auto &instance : instances) last = glm::max(last, instance.second.end());
+        if (frames == 0 && !empty())
+            frames = (int) std::ceil(last) + 1;
+    }
+
+    void clear() {
+        *this = Animation();
+    }
+};
+
+
+#endif //RAYTRACER_ANIMATION_H
@@ -0,0 +1,99 @@
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#ifndef RAYTRACER_ARENA_H
+#define RAYTRACER_ARENA_H
+
+
+/**
+ * Objects of a single type, constructed side by side in blocks and destroyed all at once.
+ * Objects never move once created, so pointers to them stay valid until clear().
+ * clear() keeps the blocks, so that refilling the arena with as many objects allocates nothing.
+ */
+template<typename T>
+class Arena {
+    typedef typename aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    struct Block {
+        unique_ptr<Slot[]> slots;
+        size_t capacity = 0;
+        size_t size = 0;
+
+        T *at(size_t i) { return reinterpret_cast<T *>(&slots[i]); }
+    };
+
+    static const size_t FIRST_BLOCK = 64;   // Objects, each block then doubles the capacity
+
+    vector<Block> blocks;
+    size_t current = 0;     // First block with room left
+    size_t count = 0;
+    size_t capacity = 0;
+
+public:
+    Arena() {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // Blocks are moved along with their objects, which keep their addresses
+    Arena(Arena &&other) noexcept : blocks(std::move(other.blocks)), current(other.current),
+                                    count(other.count), capacity(other.capacity) {
+        other.current = other.count = other.capacity = 0;
+    }
+
+    ~Arena() { clear(); }
+
+    /**
+     * Construct an object in the arena
+     * @param args Arguments of the constructor of T
+     * @return The object, owned by the arena
+     */
+    template<typename... Args>
+    T *create(Args &&... args) {
+        while (current < blocks.size() && blocks[current].size == blocks[current].capacity)
+            current++;
+
+        if (current == blocks.size()) {
+            Block block;
+            block.capacity = capacity > 0 ? capacity : FIRST_BLOCK;
+            block.slots.reset(new Slot[block.capacity]);
+            capacity += block.capacity;
+            blocks.push_back(std::move(block));
+        }
+
+        Block &block = blocks[current];
+        T *object = new(block.at(block.size)) T(std::forward<Args>(args)...);
+        block.size++;
+        count++;
+        return object;
+    }
+
+    /**
+     * Destroy every object, keeping the memory for the next ones
+     */
+    void clear() {
+        for (Block &block : blocks) {
+            for (size_t i = 0; i < block.size; i++)
+                block.at(i)->~T();
+            block.size = 0;
+        }
+        current = 0;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    /**
+     * Bytes held by the blocks, used or not
+     * @return
+     */
+    size_t memoryUsage() const { return capacity * sizeof(Slot); }
+};
+
+
+#endif //RAYTRACER_ARENA_H
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <vector>
+#include "glm.hpp"
+#include "Buffer.h"
+#include "NeededMath.h"
+#include "Packet.h"
+
+using namespace std;
+using namespace glm;
+
+#ifndef RAYTRACER_BVH_H
+#define RAYTRACER_BVH_H
+
+
+/**
+ * Node of the flattened hierarchy.
+ * A leaf (count > 0) references prims[start .. start+count[.
+ * An interior node (count == 0) has its first child right after it, and its second child at index start.
+ */
+struct BVHNode {
+    AABB bounds;
+    int start = 0;
+    int count = 0;
+};
+
+
+/**
+ * Bounding volume hierarchy built with binned SAH splits.
+ * It only knows about primitive bounds: the primitives themselves are
+ * intersected by the visitor given to traverse().
+ */
+class BVH {
+public:
+    Buffer<BVHNode> nodes;
+    Buffer<int> prims;   // Indices in the bounds array given to build()
+
+    /**
+     * Build the hierarchy over every valid box of primBounds.
+     * Invalid (empty) boxes are left out, their owner have to be tested separately.
+     *
+     * @param primBounds
+     */
+    void build(const vector<AABB> &primBounds) {
+        nodes.clear();
+        prims.clear();
+
+        vector<vec3> centroids(primBounds.size());
+        for (int i = 0; i < primBounds.size(); i++) {
+            if (!primBounds[i].isValid()) continue;
+            prims.push_back(i);
+            centroids[i] = primBounds[i].centroid();
+        }
+
+        if (prims.empty()) return;
+
+        nodes.reserve(2 * prims.size());
+        nodes.emplace_back();
+        buildNode(0, 0, prims.size(), primBounds, centroids, 0);
+        nodes.shrink_to_fit();
+    }
+
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     * Box enclosing every primitive, invalid for an empty tree
+     * @return
+     */
+    AABB bounds() const { return nodes.empty() ? AABB() : nodes[0].bounds; }
+
+    /**
+     * Update the boxes after the primitives moved, keeping the tree as it is.
+     * Much cheaper than build(), but the tree fits worse as the primitives get away from where it was built.
+     *
+     * @param primBounds Same primitives as given to build(), invalid boxes staying invalid
+     */
+    void refit(const vector<AABB> &primBounds) {
+        // Children always come after their parent
+        for (int node = (int) nodes.size() - 1; node >= 0; node--) {
+            const BVHNode &n = nodes[node];
+            AABB box;
+            if (n.count > 0) {
+                for (int i = n.start; i < n.start + n.count; i++)
+                    box.expand(primBounds[prims[i]]);
+            } else {
+                box = nodes[node + 1].bounds;
+                box.expand(nodes[n.start].bounds);
+            }
+            nodes[node].bounds = box;
+        }
+    }
+
+    /**
+     * Surface area of the boxes of every node, relative to the one of the root.
+     * Proportional to the expected cost of a ray, to tell when a refitted tree has to be built again.
+     * @return
+     */
+    float cost() const {
+        if (nodes.empty()) return 0;
+        float total = 0;
+        for (int node = 0; node < nodes.size(); node++)
+            total += nodes[node].bounds.surfaceArea();
+        float root = nodes[0].bounds.surfaceArea();
+        return root > 0 ? total / root : 0;
+    }
+
+    size_t memoryUsage() const {
+        return nodes.memoryUsage() + prims.memoryUsage();
+    }
+
+    /**
+     * Walk every leaf whose box is pierced by the ray segment [0, tMax], closest child first.
+     * The visitor is called as visit(prim, tMax) for each primitive of those leaves,
+     * it may shrink tMax to prune the rest of the walk, and returns true to stop it (any hit queries).
+     *
+     * @param ray
+     * @param tMax
+     * @param visit
+     */
+    template<typename Visitor>
+    void traverse(const Ray &ray, float tMax, Visitor &&visit) const {
+        traverseLeaves(ray, tMax, [&](const int *leaf, int count, float &leafTMax) {
+            for (int i = 0; i < count; i++) {
+                if (visit(leaf[i], leafTMax)) return true;
+            }
+            return false;
+        });
+    }
+
+    /**
+     * Same walk as traverse(), the visitor being called once per leaf as visit(prims, count, tMax),
+     * with the prims of the leaf in increasing order
+     *
+     * @param ray
+     * @param tMax
+     * @param visit
+     */
+    template<typename Visitor>
+    void traverseLeaves(const Ray &ray, float tMax, Visitor &&visit) const {
+        if (nodes.empty()) return;
+
+        const vec3 &invDir = ray.invDirection;
+
+        float tNear;
+        if (!nodes[0].bounds.intersect(ray.origin, invDir, tMax, tNear)) return;
+
+        int stack[MAX_DEPTH + 4];
+        float stackNear[MAX_DEPTH + 4];
+        int sp = 0;
+        int node = 0;
+
+        while (true) {
+            const BVHNode &n = nodes[node];
+
+            if (n.count > 0) {
+                if (visit(&prims[n.start], n.count, tMax)) return;
+            } else {
+                int first = node + 1, second = n.start;
+                float tFirst, tSecond;
+                bool hitFirst = nodes[first].bounds.intersect(ray.origin, invDir, tMax, tFirst);
+                bool hitSecond = nodes[second].bounds.intersect(ray.origin, invDir, tMax, tSecond);
+
+                if (hitFirst && hitSecond) {
+                    // Visit the closest child first, keep the other one for later
+                    if (tSecond < tFirst) {
+                        std::swap(first, second);
+                        std::swap(tFirst, tSecond);
+                    }
+                    stack[sp] = second;
+                    stackNear[sp] = tSecond;
+                    sp++;
+                    node = first;
+                    continue;
+                } else if (hitFirst) {
+                    node = first;
+                    continue;
+                } else if (hitSecond) {
+                    node = second;
+                    continue;
+                }
+            }
+
+            // Pop the next node still in reach
+            do {
+                if (sp == 0) return;
+                sp--;
+            } while (stackNear[sp] > tMax);
+            node = stack[sp];
+        }
+    }
+
+    /**
+     * Packet version of traverse(): a node is entered as soon as one of the active lanes hits its box.
+     * The visitor is called as visit(prim, tMax) with the per lane tMax, which it may shrink.
+     *
+     * @param rays
+     * @param tMax
+     * @param visit
+     */
+    template<typename Visitor>
+    void traversePacket(const RayPacket &rays, vfloat tMax, Visitor &&visit) const {
+        if (nodes.empty()) return;
+
+        vfloat tNear;
+        if (!intersectPacket(nodes[0].bounds, rays, tMax, tNear).any()) return;
+
+        int stack[MAX_DEPTH + 4];
+        int sp = 0;
+        int node = 0;
+
+        while (true) {
+            const BVHNode &n = nodes[node];
+
+            if (n.count > 0) {
+                for (int i = n.start; i < n.start + n.count; i++)
+                    visit(prims[i], tMax);
+            } else {
+                int first = node + 1, second = n.start;
+                vfloat tFirst, tSecond;
+                vmask hitFirst = intersectPacket(nodes[first].bounds, rays, tMax, tFirst);
+                vmask hitSecond = intersectPacket(nodes[second].bounds, rays, tMax, tSecond);
+
+                if (hitFirst.any() && hitSecond.any()) {
+                    // Closest child first, judged on the first lane hitting both
+                    int both = (hitFirst & hitSecond).bits();
+                    if (both) {
+                        int lane = 0;
+                        while (!(both & 1 << lane)) lane++;
+
+                        float near[2][RayPacket::SIZE];
+                        tFirst.store(near[0]);
+                        tSecond.store(near[1]);
+                        if (near[1][lane] < near[0][lane])
+                            std::swap(first, second);
+                    }
+                    stack[sp++] = second;
+                    node = first;
+                    continue;
+                } else if (hitFirst.any()) {
+                    node = first;
+                    continue;
+                } else if (hitSecond.any()) {
+                    node = second;
+                    continue;
+                }
+            }
+
+            // Pop the next node still hit by a lane, tMax may have shrunk since it was pushed
+            do {
+                if (sp == 0) return;
+                node = stack[--sp];
+            } while (!intersectPacket(nodes[node].bounds, rays, tMax, tNear).any());
+        }
+    }
+
+private:
+    static const int BINS = 16;
+    static const int MAX_LEAF = 4;
+    static const int MAX_DEPTH = 60;
+
+    /**
+     * Relative cost of stepping through a node versus intersecting a primitive
+     */
+    static constexpr float TRAVERSAL_COST = 1.f;
+
+    struct Bin {
+        AABB bounds;
+        int count = 0;
+    };
+
+    void buildNode(int nodeIdx, int start, int end, const vector<AABB> &primBounds,
+                   const vector<vec3> &centroids, int depth) {
+        AABB bounds, centroidBounds;
+        for (int i = start; i < end; i++) {
+            bounds.expand(primBounds[prims[i]]);
+            centroidBounds.expand(centroids[prims[i]]);
+        }
+        nodes[nodeIdx].bounds = bounds;
+
+        int count = end - start;
+
+        // Split along the widest axis of the centroids
+        vec3 extent = centroidBounds.pMax - centroidBounds.pMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        if (count <= 2 || extent[axis] <= 0 || depth >= MAX_DEPTH) {
+            makeLeaf(nodeIdx, start, count);
+            return;
+        }
+
+        // Bin the centroids
+        Bin bins[BINS];
+        float binScale = BINS / extent[axis];
+        float axisMin = centroidBounds.pMin[axis];
+        for (int i = start; i < end; i++) {
+            int b = binIndex(centroids[prims[i]][axis], axisMin, binScale);
+            bins[b].count++;
+            bins[b].bounds.expand(primBounds[prims[i]]);
+        }
+
+        // Sweep from the left, then from the right, to evaluate the SAH of each plane between bins
+        float leftArea[BINS - 1];
+        int leftCount[BINS - 1];
+        AABB acc;
+        int n = 0;
+        for (int b = 0; b < BINS - 1; b++) {
+            acc.expand(bins[b].bounds);
+            n += bins[b].count;
+            leftArea[b] = acc.isValid() ? acc.surfaceArea() : 0;
+            leftCount[b] = n;
+        }
+
+        float bestCost = INFINITY;
+        int bestSplit = -1;
+        acc = AABB();
+        n = 0;
+        for (int b = BINS - 1; b > 0; b--) {
+            acc.expand(bins[b].bounds);
+            n += bins[b].count;
+            if (n == 0 || leftCount[b - 1] == 0) continue;
+
+            float cost = leftCount[b - 1] * leftArea[b - 1] + n * acc.surfaceArea();
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        // Keep small nodes as leaves when splitting them is not worth it
+        float parentArea = bounds.surfaceArea();
+        float splitCost = TRAVERSAL_COST + (parentArea > 0 ? bestCost / parentArea : 0);
+        if (bestSplit < 0 || (count <= MAX_LEAF && splitCost >= count)) {
+            makeLeaf(nodeIdx, start, count);
+            return;
+        }
+
+        int *mid = std::partition(&prims[start], &prims[start] + count, [&](int p) {
+            return binIndex(centroids[p][axis], axisMin, binScale) < bestSplit;
+        });
+        int split = mid - &prims[0];
+
+        // First child lands right after its parent, the second one after the whole first subtree
+        nodes.emplace_back();
+        buildNode(nodeIdx + 1, start, split, primBounds, centroids, depth + 1);
+
+        int second = nodes.size();
+        nodes.emplace_back();
+        buildNode(second, split, end, primBounds, centroids, depth + 1);
+
+        nodes[nodeIdx].start = second;
+        nodes[nodeIdx].count = 0;
+    }
+
+    void makeLeaf(int nodeIdx, int start, int count) {
+        nodes[nodeIdx].start = start;
+        nodes[nodeIdx].count = count;
+
+        // Prims numbered by type come in runs, each intersected by its own loop
+        std::sort(&prims[start], &prims[start] + count);
+    }
+
+    static int binIndex(float centroid, float axisMin, float binScale) {
+        int b = (int) ((centroid - axisMin) * binScale);
+        return b < 0 ? 0 : (b >= BINS ? BINS - 1 : b);
+    }
+};
+
+
+#endif //RAYTRACER_BVH_H
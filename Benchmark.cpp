@@ -0,0 +1,510 @@
+#ifndef cimg_display
+#define cimg_display 0
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CImg.h>
+#include "glm.hpp"
+#include "NeededMath.h"
+#include "geometry.h"
+#include "Renderer.h"
+#include "Options.h"
+#include "SceneLoader.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace cimg_library;
+using namespace glm;
+
+/**
+ * Size of the generated scenes
+ */
+struct StressSizes {
+    int spheres = 1000;
+    int triangles = 200000;
+    int lights = 32;
+    int areaSamples = 16;           // Shadow rays at most per point and area light
+    int instances = 1000;
+    int sceneFileSpheres = 100000;
+    int width = 640, height = 480;
+};
+
+// Signatures
+vector<string> exampleScenes(const string &folder);
+
+bool benchmarkSceneFile(const string &filename, const Options &options, Scene &scene, OBJCache &objCache,
+                        SceneReport &report);
+
+void benchmarkScene(Scene &scene, int width, int height, const Options &options, SceneReport &report);
+
+void spheresScene(Scene &scene, int count);
+
+void meshScene(Scene &scene, int triangles);
+
+void lightsScene(Scene &scene, int lights);
+
+void instancesScene(Scene &scene, int instances);
+
+void areaLightsScene(Scene &scene, int samples);
+
+bool writeSpheresSceneFile(const string &path, int count, int height);
+
+Mesh sphereMesh(const vec3 &centre, float radius, int triangles);
+
+void setCamera(Scene &scene);
+
+Material material(const vec3 &color, float reflectivity = 0);
+
+
+/**
+ * Render the example scenes and generated stress scenes, with the ray counters on,
+ * and report the time of each phase, rays per second and the cost of an intersection test as JSON.
+ *
+ * Usage: RayTracerBenchmark [--threads n] [--output file.json] [--examples folder] [--quick]
+ *        [--spheres n] [--triangles n] [--lights n] [--area-samples n] [--instances n] [--scene-file n]
+ *        [--fast-intersection] [--row-order]
+ * Run it from the root of the repository, for the examples to find their OBJ files under scenes/.
+ */
+int main(int argc, char **argv) {
+    Options options;
+    options.threads = 1;            // Per thread figures by default, comparable from one machine to the other
+    options.display = false;
+    string output = "benchmark.json";
+    string examples = "examples";
+    StressSizes sizes;
+
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+        bool hasValue = a + 1 < argc;
+
+        if (arg == "--quick") {
+            sizes.spheres = 100;
+            sizes.triangles = 20000;
+            sizes.lights = 8;
+            sizes.instances = 100;
+            sizes.sceneFileSpheres = 10000;
+            sizes.width = 320;
+            sizes.height = 240;
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--output" && hasValue) {
+            output = argv[++a];
+        } else if (arg == "--examples" && hasValue) {
+            examples = argv[++a];
+        } else if (arg == "--spheres" && hasValue) {
+            sizes.spheres = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--triangles" && hasValue) {
+            sizes.triangles = glm::max(8, atoi(argv[++a]));
+        } else if (arg == "--lights" && hasValue) {
+            sizes.lights = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--area-samples" && hasValue) {
+            sizes.areaSamples = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--instances" && hasValue) {
+            sizes.instances = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--scene-file" && hasValue) {
+            sizes.sceneFileSpheres = glm::max(1, atoi(argv[++a]));
+        } else if (arg == "--fast-intersection") {
+            options.fastIntersection = true;
+        } else if (arg == "--row-order") {
+            options.rowOrder = true;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--threads n] [--output file.json] [--examples folder] [--quick]"
+                 << " [--spheres n] [--triangles n] [--lights n] [--area-samples n] [--instances n] [--scene-file n]"
+                 << " [--fast-intersection] [--row-order]" << endl;
+            return 1;
+        }
+    }
+
+    RayCounters::enabled() = true;
+    vector<SceneReport> reports;
+    bool success = true;
+
+    // The examples, at the resolution of their camera, one after the other in the same scene
+    Scene scene;
+    OBJCache objCache;
+    for (const string &filename : exampleScenes(examples)) {
+        SceneReport report;
+        if (benchmarkSceneFile(filename, options, scene, objCache, report))
+            reports.push_back(report);
+        else
+            success = false;
+    }
+
+    // Generated scenes, each stressing one part of the renderer
+    struct Stress {
+        string name;
+        void (*generate)(Scene &, int);
+        int size;
+    };
+    Stress stresses[] = {
+            {"spheres-" + to_string(sizes.spheres), spheresScene, sizes.spheres},
+            {"mesh-" + to_string(sizes.triangles), meshScene, sizes.triangles},
+            {"lights-" + to_string(sizes.lights), lightsScene, sizes.lights},
+            {"area-lights-" + to_string(sizes.areaSamples), areaLightsScene, sizes.areaSamples},
+            {"instances-" + to_string(sizes.instances), instancesScene, sizes.instances},
+    };
+    for (const Stress &stress : stresses) {
+        SceneReport report;
+        report.scene = stress.name;
+        scene.clear();
+        report.times.time("generate", [&]() { stress.generate(scene, stress.size); });
+        benchmarkScene(scene, sizes.width, sizes.height, options, report);
+        reports.push_back(report);
+    }
+
+    // The parser on a large scene file, written for the occasion
+    string sceneFile = "benchmark-spheres-" + to_string(sizes.sceneFileSpheres) + ".txt";
+    SceneReport parseReport;
+    if (writeSpheresSceneFile(sceneFile, sizes.sceneFileSpheres, sizes.height) &&
+        benchmarkSceneFile(sceneFile, options, scene, objCache, parseReport)) {
+        parseReport.scene = "scene-file-" + to_string(sizes.sceneFileSpheres);
+        reports.push_back(parseReport);
+    } else {
+        cerr << "Unable to benchmark the scene file " << sceneFile << endl;
+        success = false;
+    }
+    remove(sceneFile.c_str());
+
+    // Keep the standard output to the JSON when it goes there
+    ostream &summary = output == "-" ? cerr : cout;
+    for (const SceneReport &report : reports)
+        report.print(summary);
+    summary.flush();
+
+    if (!SceneReport::writeJSON(output, reports)) {
+        cerr << "Unable to write " << output << endl;
+        return 1;
+    }
+    if (output != "-")
+        cout << "Results written to " << output << endl;
+    return success ? 0 : 1;
+}
+
+
+/**
+ * Scene files of a folder, sorted by name
+ * @param folder
+ * @return
+ */
+vector<string> exampleScenes(const string &folder) {
+    vector<string> scenes;
+    DIR *dir = opendir(folder.c_str());
+    if (!dir) {
+        cerr << "Unable to open the folder " << folder << ", no example scenes" << endl;
+        return scenes;
+    }
+
+    while (dirent *entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+            scenes.push_back(folder + "/" + name);
+    }
+    closedir(dir);
+
+    sort(scenes.begin(), scenes.end());
+    return scenes;
+}
+
+
+/**
+ * Load and render a scene file, without saving it
+ * @param filename
+ * @param options
+ * @param scene Cleared, then filled with the scene of the file
+ * @param objCache
+ * @param report
+ * @return false if the file couldn't be loaded
+ */
+bool benchmarkSceneFile(const string &filename, const Options &options, Scene &scene, OBJCache &objCache,
+                        SceneReport &report) {
+    report.scene = filename;
+    auto loadStart = chrono::steady_clock::now();
+    PhaseTimes meshTimes;
+    scene.clear();
+    bool loaded = loadScene(filename, scene, objCache, options, meshTimes, report.sceneBytes);
+    report.times.add("scene file", chrono::duration<double>(chrono::steady_clock::now() - loadStart).count() - meshTimes.total());
+    for (const auto &phase : meshTimes.phases)
+        report.times.add(phase.first, phase.second);
+    if (!loaded)
+        return false;
+
+    benchmarkScene(scene, 0, 0, options, report);
+    return true;
+}
+
+
+/**
+ * Build the BVH of the scene and render it, filling the report
+ * @param scene
+ * @param width Resolution, 0 for the one of the camera
+ * @param height
+ * @param options Threads, precision of the intersections and order of the pixels
+ * @param report
+ */
+void benchmarkScene(Scene &scene, int width, int height, const Options &options, SceneReport &report) {
+    report.times.time("scene bvh", [&]() { scene.buildBVH(); });
+    scene.fastIntersection = options.fastIntersection;
+    int threads = options.threads;
+
+    Renderer renderer(scene, width, height);
+    renderer.pixelOrder = options.rowOrder ? PixelOrder::ROWS : PixelOrder::Z_ORDER;
+    CImg<float> image(renderer.width, renderer.height, 1, 3, 0);
+    CacheMisses misses;
+    misses.start();
+    report.times.time("render", [&]() { renderer.render(image, threads); });
+    report.cacheMisses = misses.stop();
+
+    report.width = renderer.width;
+    report.height = renderer.height;
+    report.threads = threads;
+    report.precision = options.fastIntersection ? "single" : "double";
+    report.pixelOrder = options.rowOrder ? "rows" : "z";
+    report.counters = renderer.counters;
+}
+
+
+/**
+ * Grid of spheres on a floor, a quarter of them mirrors, lit by two lights.
+ * Stresses the top level BVH and the secondary rays.
+ *
+ * @param scene
+ * @param count Number of spheres
+ */
+void spheresScene(Scene &scene, int count) {
+    setCamera(scene);
+    int side = (int) ceil(sqrt((double) count));
+    float spacing = 60.f / side;
+    float radius = spacing * 0.35f;
+
+    for (int s = 0; s < count; s++) {
+        int row = s / side, column = s % side;
+        vec3 position(-30 + (column + 0.5f) * spacing, -10 + radius, -20 - (row + 0.5f) * spacing);
+        vec3 color(0.2f + 0.6f * column / side, 0.3f, 0.2f + 0.6f * row / side);
+
+        Sphere *sphere = scene.create<Sphere>(position, radius);
+        sphere->material = material(color, s % 4 == 0 ? 0.5f : 0);
+    }
+
+    Plane *floor = scene.create<Plane>();
+    floor->position = vec3(0, -10, 0);
+    floor->normal = vec3(0, 1, 0);
+    floor->material = material(vec3(0.5f, 0.5f, 0.5f));
+
+    for (const vec3 &position : {vec3(-20, 30, 0), vec3(25, 20, -10)}) {
+        Light *light = scene.create<Light>();
+        light->position = position;
+        light->diffuseColor = vec3(0.6f, 0.6f, 0.6f);
+        light->specularColor = vec3(0.6f, 0.6f, 0.6f);
+    }
+}
+
+
+/**
+ * Write the scene of spheresScene as a scene file, for the parser to read it back
+ * @param path
+ * @param count Number of spheres
+ * @param height Of the render, the width following the 4:3 aspect ratio
+ * @return false if the file couldn't be written
+ */
+bool writeSpheresSceneFile(const string &path, int count, int height) {
+    ofstream file(path);
+    // Slightly over, the resolution being rounded down
+    file << "camera\npos: 0 0 0\nfov: 60\nf: " << (height + 0.5) / (2 * tan(M_PI / 6)) << "\na: 1.3334\n";
+
+    int side = (int) ceil(sqrt((double) count));
+    float spacing = 60.f / side;
+    float radius = spacing * 0.35f;
+    for (int s = 0; s < count; s++) {
+        int row = s / side, column = s % side;
+        vec3 position(-30 + (column + 0.5f) * spacing, -10 + radius, -20 - (row + 0.5f) * spacing);
+        vec3 color(0.2f + 0.6f * column / side, 0.3f, 0.2f + 0.6f * row / side);
+
+        file << "sphere\npos: " << position.x << " " << position.y << " " << position.z << "\nrad: " << radius
+             << "\namb: " << color.x * 0.1f << " " << color.y * 0.1f << " " << color.z * 0.1f
+             << "\ndif: " << color.x << " " << color.y << " " << color.z
+             << "\nspe: 0.5 0.5 0.5\nshi: 32\n";
+        if (s % 4 == 0) file << "ref: 0.5\n";
+    }
+
+    file << "plane\npos: 0 -10 0\nnor: 0 1 0\namb: 0.05 0.05 0.05\ndif: 0.5 0.5 0.5\nspe: 0.5 0.5 0.5\nshi: 32\n"
+         << "light\npos: -20 30 0\ndif: 0.6 0.6 0.6\nspe: 0.6 0.6 0.6\n"
+         << "light\npos: 25 20 -10\ndif: 0.6 0.6 0.6\nspe: 0.6 0.6 0.6\n";
+    file.close();
+    return !file.fail();
+}
+
+
+/**
+ * Tessellated sphere mesh in front of the camera, lit by one light.
+ * Stresses the mesh BVH and the triangle test.
+ *
+ * @param scene
+ * @param triangles Number of triangles, about
+ */
+void meshScene(Scene &scene, int triangles) {
+    setCamera(scene);
+    scene.meshes.push_back(sphereMesh(vec3(0, 0, -40), 15, triangles));
+    scene.instances.emplace_back(0, scene.materials.size());
+    scene.materials.push_back(material(vec3(0.8f, 0.5f, 0.3f)));
+
+    Light *light = scene.create<Light>();
+    light->position = vec3(-30, 30, 0);
+    light->diffuseColor = vec3(1, 1, 1);
+    light->specularColor = vec3(1, 1, 1);
+}
+
+
+/**
+ * Grid of instances of a single tessellated sphere, each one rotated and scaled, lit by one light.
+ * Stresses the two levels of BVH and the transform of the rays into the space of the instances.
+ *
+ * @param scene
+ * @param instances Number of instances
+ */
+void instancesScene(Scene &scene, int instances) {
+    setCamera(scene);
+    scene.meshes.push_back(sphereMesh(vec3(), 1, 2000));
+
+    int side = (int) ceil(sqrt((double) instances));
+    float spacing = 60.f / side;
+    for (int i = 0; i < instances; i++) {
+        int row = i / side, column = i % side;
+        vec3 position(-30 + (column + 0.5f) * spacing, -5, -20 - (row + 0.5f) * spacing);
+        vec3 scale = spacing * vec3(0.4f, 0.25f + 0.15f * (i % 3), 0.3f);
+
+        MeshInstance instance(0, scene.materials.size());
+        instance.setTransform(position, rotationMatrix(vec3(0, 37.f * i, 20.f * (i % 5))) *
+                                        mat3(vec3(scale.x, 0, 0), vec3(0, scale.y, 0), vec3(0, 0, scale.z)));
+        scene.instances.push_back(instance);
+        scene.materials.push_back(material(vec3(0.2f + 0.6f * column / side, 0.4f, 0.2f + 0.6f * row / side)));
+    }
+
+    Light *light = scene.create<Light>();
+    light->position = vec3(-30, 30, 0);
+    light->diffuseColor = vec3(1, 1, 1);
+    light->specularColor = vec3(1, 1, 1);
+}
+
+
+/**
+ * Tessellated sphere, its triangles facing outward
+ * @param centre
+ * @param radius
+ * @param triangles Number of triangles, about
+ * @return
+ */
+Mesh sphereMesh(const vec3 &centre, float radius, int triangles) {
+    // Rings x segments quads of two triangles, segments = 2 x rings
+    int rings = glm::max(2, (int) sqrt(triangles / 4.0));
+    int segments = rings * 2;
+    auto vertex = [&](int ring, int segment) {
+        double theta = M_PI * ring / rings, phi = 2 * M_PI * segment / segments;
+        return centre + radius * vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+    };
+
+    Mesh mesh;
+    mesh.reserve(rings * segments * 2);
+    auto addOutward = [&](const vec3 &a, const vec3 &b, const vec3 &c) {
+        // Counter-clockwise seen from outside, the front face for the backface culling
+        if (dot(cross(b - a, c - a), (a + b + c) / 3.f - centre) < 0)
+            mesh.addTriangle(a, c, b);
+        else
+            mesh.addTriangle(a, b, c);
+    };
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            vec3 a = vertex(r, s), b = vertex(r + 1, s), c = vertex(r + 1, s + 1), d = vertex(r, s + 1);
+            addOutward(a, b, c);
+            addOutward(a, c, d);
+        }
+    }
+    return mesh;
+}
+
+
+/**
+ * A few spheres on a floor, lit by many lights on a circle above them.
+ * Stresses the shadow rays.
+ *
+ * @param scene
+ * @param lights Number of lights
+ */
+void lightsScene(Scene &scene, int lights) {
+    setCamera(scene);
+
+    for (int s = 0; s < 16; s++) {
+        vec3 position(-18 + (s % 4) * 12, -6, -30 - (s / 4) * 12);
+        Sphere *sphere = scene.create<Sphere>(position, 4);
+        sphere->material = material(vec3(0.7f, 0.7f, 0.7f));
+    }
+
+    Plane *floor = scene.create<Plane>();
+    floor->position = vec3(0, -10, 0);
+    floor->normal = vec3(0, 1, 0);
+    floor->material = material(vec3(0.5f, 0.5f, 0.5f));
+
+    for (int l = 0; l < lights; l++) {
+        double angle = 2 * M_PI * l / lights;
+        Light *light = scene.create<Light>();
+        light->position = vec3(40 * cos(angle), 30, -45 + 40 * sin(angle));
+        light->diffuseColor = vec3(1.5f / lights, 1.5f / lights, 1.5f / lights);
+        light->specularColor = light->diffuseColor;
+    }
+}
+
+
+/**
+ * The spheres and floor of lightsScene, under two rectangle lights and a sphere light casting soft shadows.
+ * Stresses the shadow rays of the penumbras, the points fully lit or fully shadowed needing only a few.
+ *
+ * @param scene
+ * @param samples Shadow rays at most per point and light
+ */
+void areaLightsScene(Scene &scene, int samples) {
+    lightsScene(scene, 0);
+
+    vec3 positions[] = {vec3(-20, 30, -30), vec3(20, 30, -50), vec3(0, 15, -10)};
+    for (int l = 0; l < 3; l++) {
+        Light *light = scene.create<Light>();
+        light->position = positions[l];
+        light->diffuseColor = vec3(0.5f, 0.5f, 0.5f);
+        light->specularColor = light->diffuseColor;
+        light->samples = samples;
+        if (l < 2) {
+            light->shape = Light::RECTANGLE;
+            light->edge1 = vec3(12, 0, 0);
+            light->edge2 = vec3(0, 0, 8);
+        } else {
+            light->shape = Light::SPHERE;
+            light->radius = 3;
+        }
+    }
+}
+
+
+/**
+ * Camera at the origin looking down -z, with a 60 degrees field of view
+ * @param scene
+ */
+void setCamera(Scene &scene) {
+    scene.cam = Camera(vec3(0, 0, 0), 60 * (M_PI / 180), 1000, 4.f / 3);
+}
+
+
+Material material(const vec3 &color, float reflectivity) {
+    Material mat;
+    mat.ambient = color * 0.1f;
+    mat.diffuse = color;
+    mat.specular = vec3(0.5f, 0.5f, 0.5f);
+    mat.shininess = 32;
+    mat.reflectivity = reflectivity;
+    return mat;
+}
@@ -0,0 +1,119 @@
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#ifndef RAYTRACER_BUFFER_H
+#define RAYTRACER_BUFFER_H
+
+
+/**
+ * Array either owning its elements, like a vector, or viewing memory owned by someone else,
+ * such as a memory mapped cache file kept alive by the shared source.
+ * Reads go straight through a pointer in both cases. The first write to a view copies it (copy on write),
+ * so views are never modified.
+ */
+template<typename T>
+class Buffer {
+    vector<T> owned;
+    const T *ptr = nullptr;
+    size_t count = 0;
+    shared_ptr<const void> source;      // Set when viewing external memory
+
+    void sync() {
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    void own() {
+        if (source) {
+            owned.assign(ptr, ptr + count);
+            source.reset();
+            sync();
+        }
+    }
+
+public:
+    Buffer() {}
+
+    Buffer(const Buffer &other) : owned(other.owned), source(other.source) {
+        if (source) {
+            ptr = other.ptr;
+            count = other.count;
+        } else {
+            sync();
+        }
+    }
+
+    // Moving a vector keeps its storage, so the pointer stays valid
+    Buffer(Buffer &&other) noexcept : owned(std::move(other.owned)), ptr(other.ptr), count(other.count),
+                                      source(std::move(other.source)) {
+        other.ptr = nullptr;
+        other.count = 0;
+    }
+
+    Buffer &operator=(Buffer other) {
+        swap(owned, other.owned);
+        swap(ptr, other.ptr);
+        swap(count, other.count);
+        swap(source, other.source);
+        return *this;
+    }
+
+    /**
+     * View external memory instead of owning the elements
+     * @param data
+     * @param size Number of elements
+     * @param keepAlive Owner of the memory, released with the last buffer viewing it
+     */
+    void view(const T *data, size_t size, shared_ptr<const void> keepAlive) {
+        vector<T>().swap(owned);
+        ptr = data;
+        count = size;
+        source = std::move(keepAlive);
+    }
+
+    bool isView() const { return (bool) source; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T *data() const { return ptr; }
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T &back() const { return ptr[count - 1]; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + count; }
+
+    T *data() { own(); return owned.data(); }
+    T &operator[](size_t i) { own(); return owned[i]; }
+
+    void reserve(size_t n) { own(); owned.reserve(n); sync(); }
+    void resize(size_t n) { own(); owned.resize(n); sync(); }
+    void shrink_to_fit() { own(); owned.shrink_to_fit(); sync(); }
+    void push_back(const T &value) { own(); owned.push_back(value); sync(); }
+
+    void clear() {
+        source.reset();
+        owned.clear();
+        sync();
+    }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        own();
+        owned.emplace_back(std::forward<Args>(args)...);
+        sync();
+    }
+
+    /**
+     * Bytes held by the elements, allocated or viewed
+     * @return
+     */
+    size_t memoryUsage() const {
+        return source ? count * sizeof(T) : owned.capacity() * sizeof(T);
+    }
+};
+
+
+#endif //RAYTRACER_BUFFER_H
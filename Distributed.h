@@ -0,0 +1,355 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <CImg.h>
+#include "Renderer.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace cimg_library;
+
+#ifndef RAYTRACER_DISTRIBUTED_H
+#define RAYTRACER_DISTRIBUTED_H
+
+
+/**
+ * Renders the tiles of an image in worker processes, this one being the coordinator.
+ *
+ * The workers are forked once the scene is loaded and its BVH built, so each one starts from a copy of the scene
+ * without parsing it again. They talk to the coordinator over a local socket: the coordinator hands out a few tiles
+ * at a time to whichever worker is idle, each worker renders them with Renderer::renderTiles and sends every tile
+ * back as soon as it is finished. A worker that dies has the tiles it didn't send back handed out again, and if no
+ * worker is left the coordinator renders the rest itself. Pixels are the ones of Renderer::renderTiles, whichever
+ * process traces them.
+ */
+class WorkerPool {
+    Renderer &renderer;
+    int workerCount;
+    int threadsPerWorker;
+
+    // Sent by a worker for each tile, then once at the end of its job with tile = -1 and the counters of the job.
+    // Tiles are followed by their pixels, as laid out by CImg.
+    struct Message {
+        int32_t tile;           // Index in the tiles of the render
+        Window window;
+        long long samples;
+        RayCounters counters;
+    };
+
+    struct Worker {
+        pid_t pid;
+        int fd;
+        vector<int> job;        // Tiles handed out and not sent back yet
+        bool busy;
+    };
+
+public:
+    /**
+     * @param renderer
+     * @param workers Number of worker processes
+     * @param threads Render threads in all, shared between the workers
+     */
+    WorkerPool(Renderer &renderer, int workers, int threads)
+            : renderer(renderer), workerCount(glm::max(1, workers)), threadsPerWorker(glm::max(1, threads / glm::max(1, workers))) {}
+
+    /**
+     * Render the whole image, the same as Renderer::render outside of the progressive mode
+     * @param image Has to be width x height, with 3 channels
+     * @return
+     */
+    RenderStats render(CImg<float> &image) {
+        return renderTiles(renderer.makeTiles(), [&](const Tile &tile, const CImg<float> &pixels, const Window &window) {
+            for (int c = 0; c < 3; c++) {
+                for (int y = tile.y0; y < tile.y1; y++) {
+                    for (int x = tile.x0; x < tile.x1; x++)
+                        image(x, y, 0, c) = pixels(x - window.x0, y - window.y0, 0, c);
+                }
+            }
+            return true;
+        });
+    }
+
+    /**
+     * Same as Renderer::renderTiles, the tiles being rendered by the workers.
+     * The counters of the renderer get the ones of the workers.
+     *
+     * @param tiles
+     * @param done Called by the coordinator with each tile, as the workers send them back.
+     *             Returns false to stop the render.
+     * @return Complete unless done stopped it
+     */
+    template<typename Done>
+    RenderStats renderTiles(const vector<Tile> &tiles, Done &&done) {
+        RenderStats stats;
+        RayCounters counters;
+        vector<Worker> workers = start(tiles);
+
+        deque<int> pending;
+        for (int t = 0; t < tiles.size(); t++)
+            pending.push_back(t);
+        int remaining = tiles.size();
+        bool stopped = false;
+
+        // Until every tile is back, and every job ended with its counters
+        while (!stopped) {
+            // Keep every idle worker busy
+            for (Worker &worker : workers) {
+                if (worker.fd >= 0 && !worker.busy && !pending.empty() && !handOut(worker, pending))
+                    lose(worker, pending);
+            }
+
+            vector<pollfd> fds;
+            vector<Worker *> polled;
+            for (Worker &worker : workers) {
+                if (worker.fd >= 0 && worker.busy) {
+                    fds.push_back({worker.fd, POLLIN, 0});
+                    polled.push_back(&worker);
+                }
+            }
+            if (fds.empty()) break;
+
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                cerr << "Unable to wait for the workers" << endl;
+                break;
+            }
+
+            for (int f = 0; f < fds.size() && !stopped; f++) {
+                if (!fds[f].revents) continue;
+                Worker &worker = *polled[f];
+
+                Message message;
+                CImg<float> pixels;
+                if (!receive(worker.fd, message, pixels)) {
+                    lose(worker, pending);
+                    continue;
+                }
+
+                if (message.tile < 0) {
+                    // End of the job
+                    stats.samples += message.samples;
+                    counters.add(message.counters);
+                    worker.busy = false;
+                    continue;
+                }
+
+                for (int j = 0; j < worker.job.size(); j++) {
+                    if (worker.job[j] == message.tile) {
+                        worker.job.erase(worker.job.begin() + j);
+                        break;
+                    }
+                }
+                remaining--;
+                if (!done(tiles[message.tile], pixels, message.window))
+                    stopped = true;
+            }
+        }
+
+        stop(workers);
+
+        // Every worker died: the coordinator renders the rest
+        if (remaining > 0 && !stopped) {
+            cerr << "No worker left, rendering the last " << remaining << " tiles here" << endl;
+            vector<Tile> rest;
+            for (int t : pending)
+                rest.push_back(tiles[t]);
+            RenderStats local = renderer.renderTiles(rest, threadsPerWorker * workerCount, done);
+            stats.samples += local.samples;
+            counters.add(renderer.counters);
+            stopped = !local.complete;
+        }
+
+        renderer.counters = counters;
+        stats.complete = !stopped;
+        return stats;
+    }
+
+private:
+    /**
+     * Fork the workers, each one with its end of a socket
+     * @param tiles
+     * @return The workers started, fewer if some couldn't be
+     */
+    vector<Worker> start(const vector<Tile> &tiles) {
+        vector<Worker> workers;
+        cout.flush();
+        cerr.flush();
+
+        for (int w = 0; w < workerCount; w++) {
+            int ends[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+                cerr << "Unable to create the socket of a worker" << endl;
+                break;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                cerr << "Unable to start a worker" << endl;
+                close(ends[0]);
+                close(ends[1]);
+                break;
+            }
+            if (pid == 0) {
+                close(ends[0]);
+                for (const Worker &worker : workers)
+                    close(worker.fd);
+                work(ends[1], tiles);
+            }
+
+            close(ends[1]);
+            workers.push_back({pid, ends[0], vector<int>(), false});
+        }
+        return workers;
+    }
+
+    /**
+     * Body of a worker process: render the jobs handed out until told to stop, then exit.
+     * Never returns.
+     *
+     * @param fd
+     * @param tiles
+     */
+    void work(int fd, const vector<Tile> &tiles) {
+        mutex sendLock;
+        int32_t count;
+
+        while (readAll(fd, &count, sizeof(count)) && count > 0) {
+            vector<int32_t> job(count);
+            if (!readAll(fd, job.data(), count * sizeof(int32_t)))
+                break;
+
+            vector<Tile> jobTiles;
+            for (int32_t t : job)
+                jobTiles.push_back(tiles[t]);
+
+            RenderStats stats = renderer.renderTiles(jobTiles, threadsPerWorker, [&](const Tile &tile, const CImg<float> &image,
+                                                                                     const Window &window) {
+                Message message = Message();
+                for (int j = 0; j < jobTiles.size(); j++) {
+                    if (jobTiles[j].x0 == tile.x0 && jobTiles[j].y0 == tile.y0)
+                        message.tile = job[j];
+                }
+                message.window = window;
+
+                lock_guard<mutex> guard(sendLock);
+                return writeAll(fd, &message, sizeof(message)) && writeAll(fd, image.data(), (size_t) image.width() * image.height() * 3 * sizeof(float));
+            });
+            if (!stats.complete)
+                break;
+
+            Message end = Message();
+            end.tile = -1;
+            end.samples = stats.samples;
+            end.counters = renderer.counters;
+            if (!writeAll(fd, &end, sizeof(end)))
+                break;
+        }
+
+        // Leave without the exit handlers nor the destructors of the coordinator's objects
+        _exit(0);
+    }
+
+    /**
+     * Hand the next tiles out to an idle worker, enough to keep its threads busy
+     * @param worker
+     * @param pending Tiles not handed out yet
+     * @return false if the worker is gone
+     */
+    bool handOut(Worker &worker, deque<int> &pending) {
+        int32_t count = glm::min((int) pending.size(), threadsPerWorker);
+        vector<int32_t> job(pending.begin(), pending.begin() + count);
+        pending.erase(pending.begin(), pending.begin() + count);
+
+        worker.job.assign(job.begin(), job.end());
+        worker.busy = true;
+        return writeAll(worker.fd, &count, sizeof(count)) && writeAll(worker.fd, job.data(), count * sizeof(int32_t));
+    }
+
+    /**
+     * Read a message of a worker, and the pixels of its tile
+     * @param fd
+     * @param message
+     * @param pixels
+     * @return false if the worker is gone
+     */
+    static bool receive(int fd, Message &message, CImg<float> &pixels) {
+        if (!readAll(fd, &message, sizeof(message)))
+            return false;
+        if (message.tile < 0)
+            return true;
+
+        pixels.assign(message.window.width, message.window.height, 1, 3);
+        return readAll(fd, pixels.data(), (size_t) pixels.width() * pixels.height() * 3 * sizeof(float));
+    }
+
+    /**
+     * Give up on a worker that died, its tiles going back to the front of the queue
+     * @param worker
+     * @param pending
+     */
+    void lose(Worker &worker, deque<int> &pending) {
+        cerr << "Worker " << worker.pid << " is gone, " << worker.job.size() << " tiles handed out again" << endl;
+        pending.insert(pending.begin(), worker.job.begin(), worker.job.end());
+        worker.job.clear();
+        worker.busy = false;
+
+        close(worker.fd);
+        worker.fd = -1;
+        kill(worker.pid, SIGKILL);
+        waitpid(worker.pid, nullptr, 0);
+    }
+
+    /**
+     * Tell the workers still there to exit, and wait for them
+     * @param workers
+     */
+    static void stop(vector<Worker> &workers) {
+        for (Worker &worker : workers) {
+            if (worker.fd < 0) continue;
+
+            // A worker still busy is stopped rather than waited for
+            int32_t quit = 0;
+            if (worker.busy || !writeAll(worker.fd, &quit, sizeof(quit)))
+                kill(worker.pid, SIGKILL);
+            close(worker.fd);
+            worker.fd = -1;
+            waitpid(worker.pid, nullptr, 0);
+        }
+    }
+
+    static bool readAll(int fd, void *data, size_t bytes) {
+        char *p = (char *) data;
+        while (bytes > 0) {
+            ssize_t n = read(fd, p, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    // The other end being closed gives an error rather than SIGPIPE
+    static bool writeAll(int fd, const void *data, size_t bytes) {
+        const char *p = (const char *) data;
+        while (bytes > 0) {
+            ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+};
+
+
+#endif //RAYTRACER_DISTRIBUTED_H
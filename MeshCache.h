@@ -0,0 +1,218 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include "geometry.h"
+#include "OBJParser.h"
+
+using namespace std;
+
+#ifndef RAYTRACER_MESHCACHE_H
+#define RAYTRACER_MESHCACHE_H
+
+
+/**
+ * Binary cache of a mesh parsed from an OBJ file, written next to it as <file>.rtcache.
+ * It holds the triangle buffers of the Mesh and its BVH, laid out so that the mesh can view them
+ * straight from the memory mapped file, without parsing nor copying anything.
+ *
+ * Layout: the header, the path of the OBJ file, then the arrays, each starting on a 64 bytes boundary:
+ * p0 x/y/z, e1 x/y/z, e2 x/y/z (triangles floats each), the texture coordinates of the three vertices
+ * (uvs floats each, 0 if the mesh has none), the x/y/z of the normals of the three vertices (normals floats each,
+ * 0 if the mesh has none), the BVH nodes, and the BVH prims.
+ * The cache is only used if the OBJ file still has the size and modification time it was built from.
+ */
+struct MeshCacheHeader {
+    static const uint32_t VERSION = 3;
+
+    char magic[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+    uint32_t version = VERSION;
+    uint32_t layout = 0;            // Size of the structures, so that caches of other builds are rejected
+
+    uint64_t sourceSize = 0;
+    int64_t sourceSeconds = 0;      // Modification time of the OBJ file
+    int64_t sourceNanoseconds = 0;
+    uint64_t pathLength = 0;
+
+    uint64_t triangles = 0;
+    uint64_t uvs = 0;               // Triangles with texture coordinates, all of them or none
+    uint64_t normals = 0;           // Triangles with vertex normals, all of them or none
+    uint64_t nodes = 0;
+    uint64_t prims = 0;
+    AABB bounds;
+
+    static uint32_t currentLayout() {
+        return sizeof(MeshCacheHeader) | sizeof(BVHNode) << 10 | sizeof(AABB) << 20;
+    }
+};
+
+
+/**
+ * Where the cache of an OBJ file is stored
+ * @param objPath
+ * @return
+ */
+string meshCachePath(const string &objPath) {
+    return objPath + ".rtcache";
+}
+
+
+namespace meshcache {
+
+    const size_t ALIGNMENT = 64;
+
+    inline size_t align(size_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    /**
+     * Size and modification time of the OBJ file, the key of its cache
+     * @return false if the file doesn't exist
+     */
+    inline bool sourceKey(const string &objPath, MeshCacheHeader &header) {
+        return fileStamp(objPath, header.sourceSize, header.sourceSeconds, header.sourceNanoseconds);
+    }
+
+    /**
+     * Offsets of the arrays in the file, followed by the total size
+     */
+    inline vector<size_t> layout(const MeshCacheHeader &header) {
+        vector<size_t> offsets;
+        size_t offset = align(sizeof(MeshCacheHeader) + header.pathLength);
+        for (int a = 0; a < 9; a++) {
+            offsets.push_back(offset);
+            offset = align(offset + header.triangles * sizeof(float));
+        }
+        for (int a = 0; a < 6; a++) {
+            offsets.push_back(offset);
+            offset = align(offset + header.uvs * sizeof(float));
+        }
+        for (int a = 0; a < 9; a++) {
+            offsets.push_back(offset);
+            offset = align(offset + header.normals * sizeof(float));
+        }
+        offsets.push_back(offset);
+        offset = align(offset + header.nodes * sizeof(BVHNode));
+        offsets.push_back(offset);
+        offsets.push_back(offset + header.prims * sizeof(int));
+        return offsets;
+    }
+}
+
+
+/**
+ * Make the mesh view the triangles and BVH of the cache of an OBJ file, if it is up to date.
+ * The mapping stays open as long as the mesh, or a copy of it, uses it.
+ *
+ * @param objPath
+ * @param mesh Left untouched if there is no usable cache
+ * @return false if there is no cache, or it is outdated or invalid
+ */
+bool readMeshCache(const string &objPath, Mesh &mesh) {
+    MeshCacheHeader key;
+    if (!meshcache::sourceKey(objPath, key))
+        return false;
+
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    if (!file->open(meshCachePath(objPath).c_str()) || file->size < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    memcpy(&header, file->data, sizeof(MeshCacheHeader));
+    if (memcmp(header.magic, key.magic, sizeof(key.magic)) != 0 || header.version != MeshCacheHeader::VERSION
+        || header.layout != MeshCacheHeader::currentLayout())
+        return false;
+
+    // Still built from the same file
+    if (header.sourceSize != key.sourceSize || header.sourceSeconds != key.sourceSeconds
+        || header.sourceNanoseconds != key.sourceNanoseconds || header.pathLength != objPath.size()
+        || file->size < sizeof(MeshCacheHeader) + header.pathLength
+        || objPath.compare(0, string::npos, file->data + sizeof(MeshCacheHeader), header.pathLength) != 0)
+        return false;
+
+    vector<size_t> offsets = meshcache::layout(header);
+    if (file->size != offsets.back() || (header.uvs != 0 && header.uvs != header.triangles)
+        || (header.normals != 0 && header.normals != header.triangles))
+        return false;
+
+    const char *data = file->data;
+    Buffer<float> *arrays[9] = {&mesh.p0[0], &mesh.p0[1], &mesh.p0[2],
+                                &mesh.e1[0], &mesh.e1[1], &mesh.e1[2],
+                                &mesh.e2[0], &mesh.e2[1], &mesh.e2[2]};
+    for (int a = 0; a < 9; a++)
+        arrays[a]->view((const float *) (data + offsets[a]), header.triangles, file);
+    for (int a = 0; a < 6; a++)
+        mesh.uvs[a].view((const float *) (data + offsets[9 + a]), header.uvs, file);
+    for (int a = 0; a < 9; a++)
+        mesh.normals[a].view((const float *) (data + offsets[15 + a]), header.normals, file);
+    mesh.bvh.nodes.view((const BVHNode *) (data + offsets[24]), header.nodes, file);
+    mesh.bvh.prims.view((const int *) (data + offsets[25]), header.prims, file);
+    mesh.bounds = header.bounds;
+    return true;
+}
+
+
+/**
+ * Write the triangles and BVH of a mesh as the cache of an OBJ file.
+ * The file is written under a temporary name and renamed once complete, so that concurrent runs
+ * never see a partial cache.
+ *
+ * @param objPath
+ * @param mesh Has to have its BVH built
+ * @return false if the cache couldn't be written, the mesh is still usable
+ */
+bool writeMeshCache(const string &objPath, const Mesh &mesh) {
+    MeshCacheHeader header;
+    if (!meshcache::sourceKey(objPath, header))
+        return false;
+
+    header.layout = MeshCacheHeader::currentLayout();
+    header.pathLength = objPath.size();
+    header.triangles = mesh.size();
+    header.uvs = mesh.hasUVs() ? mesh.size() : 0;
+    header.normals = mesh.hasNormals() ? mesh.size() : 0;
+    header.nodes = mesh.bvh.nodes.size();
+    header.prims = mesh.bvh.prims.size();
+    header.bounds = mesh.bounds;
+
+    string path = meshCachePath(objPath);
+    string temporary = path + "." + to_string(getpid());
+    ofstream out(temporary, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+
+    vector<size_t> offsets = meshcache::layout(header);
+    auto write = [&](size_t offset, const void *data, size_t bytes) {
+        // Zero padding up to the start of the array
+        static const char zeros[meshcache::ALIGNMENT] = {};
+        out.write(zeros, offset - (size_t) out.tellp());
+        out.write((const char *) data, bytes);
+    };
+
+    out.write((const char *) &header, sizeof(header));
+    out.write(objPath.data(), objPath.size());
+    const Buffer<float> *arrays[9] = {&mesh.p0[0], &mesh.p0[1], &mesh.p0[2],
+                                      &mesh.e1[0], &mesh.e1[1], &mesh.e1[2],
+                                      &mesh.e2[0], &mesh.e2[1], &mesh.e2[2]};
+    for (int a = 0; a < 9; a++)
+        write(offsets[a], arrays[a]->data(), header.triangles * sizeof(float));
+    for (int a = 0; a < 6; a++)
+        write(offsets[9 + a], mesh.uvs[a].data(), header.uvs * sizeof(float));
+    for (int a = 0; a < 9; a++)
+        write(offsets[15 + a], mesh.normals[a].data(), header.normals * sizeof(float));
+    write(offsets[24], mesh.bvh.nodes.data(), header.nodes * sizeof(BVHNode));
+    write(offsets[25], mesh.bvh.prims.data(), header.prims * sizeof(int));
+    out.close();
+
+    if (!out || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+#endif //RAYTRACER_MESHCACHE_H
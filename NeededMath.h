@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 
 #ifndef RAYTRACER_NEEDEDMATH_H
 #define RAYTRACER_NEEDEDMATH_H
@@ -27,14 +29,123 @@ void clampColor(vec3 &color){
 }
 
 
+/**
+ * Rotation about the x axis, then the y axis, then the z axis
+ * @param degrees Angle about each axis
+ * @return
+ */
+mat3 rotationMatrix(const vec3 &degrees) {
+    vec3 c(cos(radians(degrees.x)), cos(radians(degrees.y)), cos(radians(degrees.z)));
+    vec3 s(sin(radians(degrees.x)), sin(radians(degrees.y)), sin(radians(degrees.z)));
+
+    // Column major, as glm
+    mat3 x(vec3(1, 0, 0), vec3(0, c.x, s.x), vec3(0, -s.x, c.x));
+    mat3 y(vec3(c.y, 0, -s.y), vec3(0, 1, 0), vec3(s.y, 0, c.y));
+    mat3 z(vec3(c.z, s.z, 0), vec3(-s.z, c.z, 0), vec3(0, 0, 1));
+    return z * y * x;
+}
+
+
+/**
+ * Slack of the barycentric inside test of triangles,
+ * keeps the edges shared by two triangles watertight despite rounding
+ */
+const float TRIANGLE_EDGE_SLACK = 0.000001f;
+
+
 /**
  * Rays
  */
 struct Ray {
     vec3 origin;
     vec3 direction;
+    vec3 invDirection;      // 1 / direction, for the slab tests of the boxes
+
+    // Also hit the back of the surfaces, for rays travelling inside a transparent object
+    bool backfaces = false;
+
+    Ray() {}
+
+    Ray(const vec3 &origin, const vec3 &direction)
+            : origin(origin), direction(direction),
+              invDirection(1.f / direction.x, 1.f / direction.y, 1.f / direction.z) {}
+};
+
+
+/**
+ * Axis aligned bounding box
+ * An empty box has pMin > pMax on every axis
+ */
+struct AABB {
+    vec3 pMin = vec3(INFINITY, INFINITY, INFINITY);
+    vec3 pMax = vec3(-INFINITY, -INFINITY, -INFINITY);
+
+    bool isValid() const { return pMin.x <= pMax.x; }
+
+    void expand(const vec3 &p) {
+        pMin = vec3(std::min(pMin.x, p.x), std::min(pMin.y, p.y), std::min(pMin.z, p.z));
+        pMax = vec3(std::max(pMax.x, p.x), std::max(pMax.y, p.y), std::max(pMax.z, p.z));
+    }
+
+    void expand(const AABB &box) {
+        if (!box.isValid()) return;
+        expand(box.pMin);
+        expand(box.pMax);
+    }
+
+    /**
+     * Grow the box on every side, used to keep the bounds conservative against float rounding
+     * @param amount
+     */
+    void pad(float amount) {
+        pMin -= vec3(amount, amount, amount);
+        pMax += vec3(amount, amount, amount);
+    }
+
+    /**
+     * Grow the box by a margin relative to the magnitude of its coordinates,
+     * so rounding in the intersection routines can never place a hit outside of it
+     */
+    void padForRounding() {
+        float m = 0;
+        for (int a = 0; a < 3; a++)
+            m = std::max(m, std::max(std::fabs(pMin[a]), std::fabs(pMax[a])));
+        pad(1e-5f * m + 1e-6f);
+    }
+
+    vec3 centroid() const { return (pMin + pMax) * 0.5f; }
+
+    float surfaceArea() const {
+        vec3 d = pMax - pMin;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    /**
+     * Slab test against the ray segment [0, tMax].
+     * invDir is 1/ray.direction, computed once per ray.
+     *
+     * @param origin
+     * @param invDir
+     * @param tMax
+     * @param tNear Entry distance, valid only when returning true
+     * @return
+     */
+    bool intersect(const vec3 &origin, const vec3 &invDir, float tMax, float &tNear) const {
+        float t0 = 0, t1 = tMax;
+        for (int a = 0; a < 3; a++) {
+            float tA = (pMin[a] - origin[a]) * invDir[a];
+            float tB = (pMax[a] - origin[a]) * invDir[a];
+            if (tA > tB) std::swap(tA, tB);
+
+            // Written so that a NaN slab (origin on the plane of a flat axis) never rejects
+            t0 = tA > t0 ? tA : t0;
+            t1 = tB < t1 ? tB : t1;
+        }
 
-    Ray(const vec3 &origin, const vec3 &direction) : origin(origin), direction(direction) {}
+        // Scale the exit distance up a little so rounding never culls a grazing ray
+        tNear = t0;
+        return t0 <= t1 * 1.0000004f;
+    }
 };
 
 
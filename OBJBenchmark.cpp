@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glm.hpp"
+#include "OBJParser.h"
+#include "OBJloader.h"
+
+using namespace std;
+using namespace glm;
+
+// Signatures
+double timeRuns(int runs, const function<void()> &load);
+
+
+/**
+ * Compare the load time of an OBJ file between the original loader and the parallel one,
+ * and check both read the same triangles.
+ *
+ * Usage: OBJBenchmark file.obj [runs] [threads]
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " file.obj [runs] [threads]" << endl;
+        return 1;
+    }
+    const char *path = argv[1];
+    int runs = argc > 2 ? glm::max(1, atoi(argv[2])) : 3;
+    int threads = argc > 3 ? atoi(argv[3]) : (int) thread::hardware_concurrency();
+    threads = glm::max(1, threads);
+
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Unable to open " << path << endl;
+        return 1;
+    }
+    double megabytes = file.size / (1024. * 1024.);
+    cout << path << ": " << megabytes << " MB, best of " << runs << " runs" << endl;
+
+    // Original loader, de-indexing every triangle
+    vector<vec3> vertices;
+    bool oldLoaded = false;
+    double oldTime = timeRuns(runs, [&]() {
+        vector<vec3> normals;
+        vector<vec2> uvs;
+        vertices.clear();
+        oldLoaded = loadOBJ(path, vertices, normals, uvs);
+    });
+
+    OBJData obj;
+    bool loaded = false;
+    double singleTime = timeRuns(runs, [&]() { loaded = loadOBJFast(path, obj, 1); });
+    double parallelTime = timeRuns(runs, [&]() { loaded = loadOBJFast(path, obj, threads); });
+    if (!loaded)
+        return 1;
+
+    auto report = [&](const string &name, double seconds) {
+        cout << "  " << name << ": " << seconds * 1000 << " ms, " << megabytes / seconds << " MB/s";
+        if (oldLoaded) cout << ", x" << oldTime / seconds;
+        cout << endl;
+    };
+    if (oldLoaded) report("loadOBJ", oldTime);
+    else cout << "  loadOBJ: failed" << endl;
+    report("loadOBJFast, 1 thread", singleTime);
+    report("loadOBJFast, " + to_string(threads) + " threads", parallelTime);
+
+    cout << obj.triangleCount() << " triangles, " << obj.positions.size() << " vertices" << endl;
+
+    // Same triangles, in the same order
+    if (!oldLoaded) {
+        cout << "loadOBJ couldn't read the file, nothing to compare" << endl;
+        return 0;
+    }
+    bool same = vertices.size() == obj.triangleCount() * 3;
+    for (size_t t = 0; same && t < obj.triangleCount(); t++) {
+        for (int c = 0; c < 3; c++)
+            same &= vertices[t * 3 + c] == obj.corner(t, c);
+    }
+    cout << "Triangles " << (same ? "match" : "DIFFER from") << " the ones of loadOBJ" << endl;
+
+    return same ? 0 : 1;
+}
+
+
+/**
+ * Best time of several runs of a loader
+ * @param runs
+ * @param load
+ * @return Seconds
+ */
+double timeRuns(int runs, const function<void()> &load) {
+    double best = INFINITY;
+    for (int r = 0; r < runs; r++) {
+        auto start = chrono::steady_clock::now();
+        load();
+        best = glm::min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
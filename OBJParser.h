@@ -0,0 +1,489 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "glm.hpp"
+
+using namespace std;
+using namespace glm;
+
+#ifndef RAYTRACER_OBJPARSER_H
+#define RAYTRACER_OBJPARSER_H
+
+
+/**
+ * Content of an OBJ file, kept indexed: every vertex is stored once, and each triangle corner
+ * points into the vertex buffers. Faces with more than 3 corners are split in a fan around their first corner.
+ * The uv and normal indices are left empty when the file has none, and hold -1 for corners without one.
+ */
+struct OBJData {
+    vector<vec3> positions;
+    vector<vec2> uvs;
+    vector<vec3> normals;
+
+    // 3 per triangle, 0-based
+    vector<int> positionIndices;
+    vector<int> uvIndices;
+    vector<int> normalIndices;
+
+    size_t triangleCount() const { return positionIndices.size() / 3; }
+
+    vec3 corner(size_t triangle, int c) const { return positions[positionIndices[triangle * 3 + c]]; }
+};
+
+
+/**
+ * Read-only view of a whole file, memory mapped when possible
+ */
+class MappedFile {
+    int fd = -1;
+    void *mapping = nullptr;
+    vector<char> fallback;
+
+public:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (mapping) munmap(mapping, size);
+        if (fd >= 0) close(fd);
+    }
+
+    /**
+     * @param path
+     * @return false if the file can't be opened
+     */
+    bool open(const char *path) {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) return false;
+        size = info.st_size;
+        if (size == 0) return true;
+
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            mapping = map;
+            data = (const char *) map;
+            madvise(map, size, MADV_SEQUENTIAL);
+            return true;
+        }
+
+        // Some file systems can't be mapped, read the file instead
+        fallback.resize(size);
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = read(fd, fallback.data() + done, size - done);
+            if (n <= 0) return false;
+            done += n;
+        }
+        data = fallback.data();
+        return true;
+    }
+};
+
+
+/**
+ * Size and modification time of a file, which the caches built from it are keyed on
+ * @param path
+ * @param size
+ * @param seconds
+ * @param nanoseconds
+ * @return false if the file doesn't exist
+ */
+inline bool fileStamp(const string &path, uint64_t &size, int64_t &seconds, int64_t &nanoseconds) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+
+    size = info.st_size;
+#if defined(__APPLE__)
+    seconds = info.st_mtimespec.tv_sec;
+    nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+    seconds = info.st_mtim.tv_sec;
+    nanoseconds = info.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+
+/**
+ * Hand-written number parsing for the OBJ and scene readers, much faster than the locale-aware strtof/sscanf.
+ * They advance p past the number, and return false without moving it if there is none.
+ */
+namespace objparse {
+
+    inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    inline void skipBlanks(const char *&p, const char *end) {
+        while (p < end && isBlank(*p)) p++;
+    }
+
+    inline bool parseInt(const char *&p, const char *end, int &out) {
+        const char *s = p;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+        if (s >= end || *s < '0' || *s > '9') return false;
+
+        long long value = 0;
+        while (s < end && *s >= '0' && *s <= '9' && value < INT32_MAX)
+            value = value * 10 + (*s++ - '0');
+
+        out = (int) (negative ? -value : value);
+        p = s;
+        return true;
+    }
+
+    inline bool parseDouble(const char *&p, const char *end, double &out) {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        const char *s = p;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+
+        // Up to 19 significant digits fit in the mantissa, the others only shift the exponent
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any = false;
+        while (s < end && *s >= '0' && *s <= '9') {
+            if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) digits++; }
+            else exponent++;
+            s++;
+            any = true;
+        }
+        if (s < end && *s == '.') {
+            s++;
+            while (s < end && *s >= '0' && *s <= '9') {
+                if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) digits++; exponent--; }
+                s++;
+                any = true;
+            }
+        }
+
+        if (!any) {
+            // inf, nan and the like: rare enough to be left to the C library
+            char buffer[32];
+            size_t n = 0;
+            while (p + n < end && n < sizeof(buffer) - 1 && !isBlank(p[n]) && p[n] != '\n') {
+                buffer[n] = p[n];
+                n++;
+            }
+            buffer[n] = 0;
+            char *stop;
+            out = strtod(buffer, &stop);
+            if (stop == buffer) return false;
+            p += stop - buffer;
+            return true;
+        }
+
+        if (s < end && (*s == 'e' || *s == 'E')) {
+            const char *e = s + 1;
+            int value;
+            if (parseInt(e, end, value)) {
+                exponent += value;
+                s = e;
+            }
+        }
+
+        double result = (double) mantissa;
+        if (exponent < 0) {
+            while (exponent < -22) { result /= 1e22; exponent += 22; }
+            result /= powers[-exponent];
+        } else if (exponent > 0) {
+            while (exponent > 22) { result *= 1e22; exponent -= 22; }
+            result *= powers[exponent];
+        }
+
+        out = negative ? -result : result;
+        p = s;
+        return true;
+    }
+
+    inline bool parseFloat(const char *&p, const char *end, float &out) {
+        double value;
+        if (!parseDouble(p, end, value)) return false;
+        out = (float) value;
+        return true;
+    }
+
+    /**
+     * What one thread parsed from its share of the file.
+     * Negative (relative) indices depend on how many vertices the earlier chunks hold,
+     * they are resolved locally and listed so that the chunk offset can be added once known.
+     */
+    struct Chunk {
+        const char *begin, *end;
+
+        vector<vec3> positions;
+        vector<vec2> uvs;
+        vector<vec3> normals;
+        vector<int> positionIndices, uvIndices, normalIndices;
+        vector<size_t> relativePositions, relativeUVs, relativeNormals;
+
+        // First problem met, with where it happened
+        const char *errorAt = nullptr;
+        string error;
+    };
+
+    /**
+     * Resolve the index of a face corner: positive indices count from 1, negative ones back from the last vertex read
+     * @param raw
+     * @param count Vertices read so far in the chunk
+     * @param out
+     * @param relative Gets the position of the index in out if it still needs the offset of the chunk
+     */
+    inline void addIndex(int raw, size_t count, vector<int> &out, vector<size_t> &relative) {
+        if (raw < 0) {
+            relative.push_back(out.size());
+            out.push_back((int) count + raw);
+        } else {
+            out.push_back(raw - 1);
+        }
+    }
+
+    inline void parseChunk(Chunk &chunk) {
+        const int MAX_CORNERS = 64;
+        const char *p = chunk.begin, *end = chunk.end;
+
+        auto fail = [&](const char *at, const char *what) {
+            chunk.errorAt = at;
+            chunk.error = what;
+        };
+
+        while (p < end) {
+            skipBlanks(p, end);
+            const char *line = p;
+
+            if (p + 1 < end && p[0] == 'v' && isBlank(p[1])) {
+                p += 2;
+                vec3 v;
+                for (int a = 0; a < 3; a++) {
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, v[a])) return fail(line, "Invalid vertex position");
+                }
+                chunk.positions.push_back(v);
+            } else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+                p += 3;
+                vec2 uv;
+                for (int a = 0; a < 2; a++) {
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, uv[a])) return fail(line, "Invalid texture coordinate");
+                }
+                chunk.uvs.push_back(uv);
+            } else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+                p += 3;
+                vec3 n;
+                for (int a = 0; a < 3; a++) {
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, n[a])) return fail(line, "Invalid vertex normal");
+                }
+                chunk.normals.push_back(n);
+            } else if (p + 1 < end && p[0] == 'f' && isBlank(p[1])) {
+                p += 2;
+
+                // Corners as written: v, v/vt, v//vn or v/vt/vn
+                int v[MAX_CORNERS], vt[MAX_CORNERS], vn[MAX_CORNERS];
+                int corners = 0;
+                skipBlanks(p, end);
+                while (p < end && *p != '\n' && *p != '#') {
+                    if (corners == MAX_CORNERS) return fail(line, "Face with too many corners");
+                    vt[corners] = vn[corners] = 0;
+                    if (!parseInt(p, end, v[corners])) return fail(line, "Invalid face");
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (p < end && *p != '/' && !parseInt(p, end, vt[corners])) return fail(line, "Invalid face");
+                        if (p < end && *p == '/') {
+                            p++;
+                            if (!parseInt(p, end, vn[corners])) return fail(line, "Invalid face");
+                        }
+                    }
+                    if (v[corners] == 0) return fail(line, "Invalid face index 0");
+                    corners++;
+                    skipBlanks(p, end);
+                }
+                if (corners < 3) return fail(line, "Face with less than 3 corners");
+
+                // Fan around the first corner
+                for (int c = 1; c + 1 < corners; c++) {
+                    const int tri[3] = {0, c, c + 1};
+                    for (int k : tri) {
+                        addIndex(v[k], chunk.positions.size(), chunk.positionIndices, chunk.relativePositions);
+
+                        // 0 stands for a missing uv or normal
+                        if (vt[k] == 0) chunk.uvIndices.push_back(-1);
+                        else addIndex(vt[k], chunk.uvs.size(), chunk.uvIndices, chunk.relativeUVs);
+                        if (vn[k] == 0) chunk.normalIndices.push_back(-1);
+                        else addIndex(vn[k], chunk.normals.size(), chunk.normalIndices, chunk.relativeNormals);
+                    }
+                }
+            }
+
+            // Anything else (comments, groups, materials...) is skipped with the rest of the line
+            const char *eol = (const char *) memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+        }
+    }
+
+    /**
+     * Add the vertex count of the earlier chunks to the relative indices.
+     * Those still pointing before the first vertex are made out of range, rather than passing for a missing attribute.
+     */
+    inline void resolveRelative(vector<int> &indices, const vector<size_t> &relative, size_t base) {
+        for (size_t i : relative) {
+            long long index = indices[i] + (long long) base;
+            indices[i] = index < 0 ? INT32_MAX : (int) index;
+        }
+    }
+
+    /**
+     * Check every index points to an existing vertex
+     * @param indices
+     * @param count
+     * @param allowMissing Accept -1 for corners without the attribute
+     * @return
+     */
+    inline bool indicesInRange(const vector<int> &indices, size_t count, bool allowMissing) {
+        for (int index : indices) {
+            if (index >= (int) count || index < (allowMissing ? -1 : 0))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Line number of a position in the file, for the error messages
+     */
+    inline size_t lineOf(const char *data, const char *at) {
+        size_t line = 1;
+        for (const char *c = data; c < at; c++)
+            line += *c == '\n';
+        return line;
+    }
+
+    template<typename T>
+    void append(vector<T> &out, const vector<T> &in, size_t at) {
+        if (!in.empty())
+            memcpy(&out[at], in.data(), in.size() * sizeof(T));
+    }
+}
+
+
+/**
+ * Read an OBJ file: memory mapped, cut into chunks of whole lines parsed in parallel, then merged.
+ * Supports v, vt, vn and f lines, negative indices and faces of any number of corners; the rest is ignored.
+ * Prints the problem and returns false if the file can't be read or holds invalid data.
+ *
+ * @param path
+ * @param out
+ * @param threads Maximum number of parsing threads
+ * @return
+ */
+bool loadOBJFast(const char *path, OBJData &out, int threads) {
+    using namespace objparse;
+    out = OBJData();
+
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Unable to open OBJ file " << path << endl;
+        return false;
+    }
+
+    // Chunks of at least 1 MB, not worth a thread otherwise
+    const size_t MIN_CHUNK = 1 << 20;
+    int chunkCount = (int) glm::max((size_t) 1, glm::min((size_t) glm::max(threads, 1), file.size / MIN_CHUNK));
+
+    // Split on line boundaries
+    vector<Chunk> chunks(chunkCount);
+    const char *fileEnd = file.data + file.size;
+    const char *begin = file.data;
+    for (int c = 0; c < chunkCount; c++) {
+        const char *end = c + 1 == chunkCount ? fileEnd : file.data + file.size * (c + 1) / chunkCount;
+        if (end < begin) end = begin;
+        const char *eol = end < fileEnd ? (const char *) memchr(end, '\n', fileEnd - end) : nullptr;
+        end = eol ? eol + 1 : fileEnd;
+
+        chunks[c].begin = begin;
+        chunks[c].end = end;
+        begin = end;
+    }
+
+    auto runParallel = [&](const function<void(Chunk &)> &work) {
+        vector<thread> pool;
+        for (int c = 1; c < chunkCount; c++)
+            pool.emplace_back([&, c]() { work(chunks[c]); });
+        work(chunks[0]);
+        for (thread &t : pool)
+            t.join();
+    };
+
+    runParallel(parseChunk);
+
+    for (const Chunk &chunk : chunks) {
+        if (chunk.errorAt) {
+            cerr << path << ":" << lineOf(file.data, chunk.errorAt) << ": " << chunk.error << endl;
+            return false;
+        }
+    }
+
+    // Offsets of each chunk in the merged buffers
+    vector<size_t> positionBase(chunkCount + 1, 0), uvBase(chunkCount + 1, 0), normalBase(chunkCount + 1, 0), indexBase(chunkCount + 1, 0);
+    for (int c = 0; c < chunkCount; c++) {
+        positionBase[c + 1] = positionBase[c] + chunks[c].positions.size();
+        uvBase[c + 1] = uvBase[c] + chunks[c].uvs.size();
+        normalBase[c + 1] = normalBase[c] + chunks[c].normals.size();
+        indexBase[c + 1] = indexBase[c] + chunks[c].positionIndices.size();
+    }
+
+    out.positions.resize(positionBase[chunkCount]);
+    out.uvs.resize(uvBase[chunkCount]);
+    out.normals.resize(normalBase[chunkCount]);
+    out.positionIndices.resize(indexBase[chunkCount]);
+    out.uvIndices.resize(indexBase[chunkCount]);
+    out.normalIndices.resize(indexBase[chunkCount]);
+
+    // Relative indices get the vertex count of the earlier chunks, then everything is copied in place
+    runParallel([&](Chunk &chunk) {
+        size_t c = &chunk - chunks.data();
+        resolveRelative(chunk.positionIndices, chunk.relativePositions, positionBase[c]);
+        resolveRelative(chunk.uvIndices, chunk.relativeUVs, uvBase[c]);
+        resolveRelative(chunk.normalIndices, chunk.relativeNormals, normalBase[c]);
+
+        append(out.positions, chunk.positions, positionBase[c]);
+        append(out.uvs, chunk.uvs, uvBase[c]);
+        append(out.normals, chunk.normals, normalBase[c]);
+        append(out.positionIndices, chunk.positionIndices, indexBase[c]);
+        append(out.uvIndices, chunk.uvIndices, indexBase[c]);
+        append(out.normalIndices, chunk.normalIndices, indexBase[c]);
+        chunk = Chunk();
+    });
+
+    if (!indicesInRange(out.positionIndices, out.positions.size(), false)
+        || !indicesInRange(out.uvIndices, out.uvs.size(), true)
+        || !indicesInRange(out.normalIndices, out.normals.size(), true)) {
+        cerr << path << ": face index out of range" << endl;
+        return false;
+    }
+
+    // Don't keep index buffers of attributes the file doesn't have
+    if (out.uvs.empty()) vector<int>().swap(out.uvIndices);
+    if (out.normals.empty()) vector<int>().swap(out.normalIndices);
+
+    return true;
+}
+
+
+#endif //RAYTRACER_OBJPARSER_H
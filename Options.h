@@ -0,0 +1,287 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SIMD.h"
+
+using namespace std;
+
+#ifndef RAYTRACER_OPTIONS_H
+#define RAYTRACER_OPTIONS_H
+
+
+/**
+ * Settings given on the command line
+ */
+struct Options {
+    vector<string> scenes;
+    string output;                  // Output of a single scene render, "render.bmp" if empty
+    string outputDir;               // Folder of the renders of a batch, named after their scene file
+    string format = "bmp";          // Extension of the renders of a batch
+    bool half = false;              // Half floats in EXR files
+    bool preview = true;            // PNG preview next to PFM and EXR files
+    int width = 0, height = 0;      // Resolution override, 0 keeps the one of the camera
+    int threads = 0;                // 0 uses every core
+    int workers = 0;                // Worker processes rendering the tiles, 0 renders in this process
+    bool display = true;
+    bool interactive = false;       // Move the camera in the window, the render refining after each move
+    bool packets = false;           // Trace primary rays by SIMD packets
+    bool rowOrder = false;          // Trace the pixels of a tile row by row, straight into the planar image
+    bool comparePackets = false;    // Render both ways and check the packets against the scalar path
+    bool fastIntersection = false;  // Single precision sphere and plane intersections
+    bool compareFastIntersection = false;   // Render both ways and check them against the double precision ones
+    int maxDepth = 5;               // Reflection and refraction bounces
+    bool meshCache = true;          // Read and write the binary cache next to each OBJ file
+    int textureMemory = 64;         // Megabytes of texture tiles kept in memory at most
+    int samples = 0;                // Samples per pixel at most, 0 for the default: 1, or 16 in progressive mode
+    float threshold = 4.f;          // Difference between samples worth refining, on the 0-255 scale
+    bool progressive = false;       // Refine the image over passes
+    double timeBudget = 0;          // Seconds given to the progressive refinement, 0 for no limit
+    bool stats = false;             // Print the time of each phase and the ray counters
+    string statsJSON;               // File getting them as JSON, one object per scene
+};
+
+
+/**
+ * Print the command line help
+ * @param program
+ */
+void printUsage(const char *program) {
+    cout << "Usage: " << program << " [options] scene.txt [scene2.txt ...]" << endl
+         << "Without arguments, the scene file to render is asked for interactively." << endl
+         << endl
+         << "Options:" << endl
+         << "  -o, --output <file>         Output image of a single scene (default: render.bmp)" << endl
+         << "  -d, --output-dir <dir>      Folder for the renders of a batch, named after each scene file" << endl
+         << "  -f, --format <ext>          Format of the renders of a batch: bmp (default), pfm or exr" << endl
+         << "      --half                  Store half floats rather than floats in EXR files" << endl
+         << "      --no-preview            Don't write a PNG preview next to PFM and EXR files" << endl
+         << "  -r, --resolution <W>x<H>    Override the resolution given by the camera" << endl
+         << "  -t, --threads <n>           Number of render threads (default: every core)" << endl
+         << "  -w, --workers <n>           Render the tiles in n local worker processes, sharing the threads" << endl
+         << "      --no-display            Don't open a window on the render, for headless machines" << endl
+         << "  -i, --interactive           Move the camera in the window with W A S D Q E or the arrows and page keys," << endl
+         << "                              the render refining from a coarse level after each move" << endl
+         << "      --packets               Trace primary rays by SIMD packets (" << simdName() << ")" << endl
+         << "      --compare-packets       Render with and without packets, and check every pixel agrees" << endl
+         << "      --row-order             Trace the pixels of each tile row by row rather than in Z order" << endl
+         << "      --fast-intersection     Intersect spheres and planes in single precision, with precomputed constants" << endl
+         << "      --compare-fast          Render with double and single precision intersections, check every pixel" << endl
+         << "                              agrees and print the speedup" << endl
+         << "  -s, --samples <n>           Samples per pixel at most, spent on edges and noisy pixels (default: 1)" << endl
+         << "      --threshold <t>         Color difference worth more samples, on the 0-255 scale (default: 4)" << endl
+         << "      --progressive           Refine the whole image over passes, 16 samples per pixel at most by default" << endl
+         << "      --time-budget <s>       Stop the progressive refinement after the given seconds" << endl
+         << "      --max-depth <n>         Reflection and refraction bounces at most (default: 5)" << endl
+         << "      --no-mesh-cache         Always parse the OBJ files, without reading nor writing their .rtcache" << endl
+         << "      --texture-memory <MB>   Texture tiles kept in memory at most (default: 64)" << endl
+         << "      --stats                 Print the time of each phase, and count the rays and intersection tests" << endl
+         << "      --stats-json <file>     Write the same as JSON, one object per scene (- for the standard output)" << endl
+         << "  -h, --help                  Show this help" << endl;
+}
+
+
+/**
+ * Parse the command line into options.
+ * Prints the problem and returns false on invalid arguments.
+ *
+ * @param argc
+ * @param argv
+ * @param options
+ * @return
+ */
+bool parseArguments(int argc, char **argv, Options &options) {
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+
+        // Options expecting a value
+        auto value = [&](const char *&out) {
+            if (a + 1 >= argc) {
+                cerr << "Missing value for " << arg << endl;
+                return false;
+            }
+            out = argv[++a];
+            return true;
+        };
+        const char *val;
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            exit(0);
+        } else if (arg == "--no-display") {
+            options.display = false;
+        } else if (arg == "-i" || arg == "--interactive") {
+            options.interactive = true;
+        } else if (arg == "--packets") {
+            options.packets = true;
+        } else if (arg == "--compare-packets") {
+            options.comparePackets = true;
+        } else if (arg == "--row-order") {
+            options.rowOrder = true;
+        } else if (arg == "--fast-intersection") {
+            options.fastIntersection = true;
+        } else if (arg == "--compare-fast") {
+            options.compareFastIntersection = true;
+        } else if (arg == "--half") {
+            options.half = true;
+        } else if (arg == "--no-preview") {
+            options.preview = false;
+        } else if (arg == "--no-mesh-cache") {
+            options.meshCache = false;
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--stats-json") {
+            if (!value(val)) return false;
+            options.statsJSON = val;
+        } else if (arg == "-o" || arg == "--output") {
+            if (!value(val)) return false;
+            options.output = val;
+        } else if (arg == "-d" || arg == "--output-dir") {
+            if (!value(val)) return false;
+            options.outputDir = val;
+        } else if (arg == "-f" || arg == "--format") {
+            if (!value(val)) return false;
+            options.format = val;
+            if (options.format != "bmp" && options.format != "pfm" && options.format != "exr") {
+                cerr << "Invalid format " << val << ", expected bmp, pfm or exr" << endl;
+                return false;
+            }
+        } else if (arg == "-r" || arg == "--resolution") {
+            if (!value(val)) return false;
+            if (sscanf(val, "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+                cerr << "Invalid resolution " << val << ", expected <width>x<height>" << endl;
+                return false;
+            }
+        } else if (arg == "--progressive") {
+            options.progressive = true;
+        } else if (arg == "-s" || arg == "--samples") {
+            if (!value(val)) return false;
+            options.samples = atoi(val);
+            if (options.samples <= 0) {
+                cerr << "Invalid sample count " << val << endl;
+                return false;
+            }
+        } else if (arg == "--threshold") {
+            if (!value(val)) return false;
+            options.threshold = atof(val);
+            if (!(options.threshold > 0)) {
+                cerr << "Invalid threshold " << val << endl;
+                return false;
+            }
+        } else if (arg == "--time-budget") {
+            if (!value(val)) return false;
+            options.timeBudget = atof(val);
+            options.progressive = true;
+            if (!(options.timeBudget > 0)) {
+                cerr << "Invalid time budget " << val << endl;
+                return false;
+            }
+        } else if (arg == "--max-depth") {
+            if (!value(val)) return false;
+            options.maxDepth = atoi(val);
+            if (options.maxDepth < 0 || (options.maxDepth == 0 && strcmp(val, "0") != 0)) {
+                cerr << "Invalid max depth " << val << endl;
+                return false;
+            }
+        } else if (arg == "-t" || arg == "--threads") {
+            if (!value(val)) return false;
+            options.threads = atoi(val);
+            if (options.threads <= 0) {
+                cerr << "Invalid thread count " << val << endl;
+                return false;
+            }
+        } else if (arg == "--texture-memory") {
+            if (!value(val)) return false;
+            options.textureMemory = atoi(val);
+            if (options.textureMemory <= 0) {
+                cerr << "Invalid texture memory " << val << endl;
+                return false;
+            }
+        } else if (arg == "-w" || arg == "--workers") {
+            if (!value(val)) return false;
+            options.workers = atoi(val);
+            if (options.workers <= 0) {
+                cerr << "Invalid worker count " << val << endl;
+                return false;
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            cerr << "Unknown option " << arg << endl;
+            return false;
+        } else {
+            options.scenes.push_back(arg);
+        }
+    }
+
+    if (options.scenes.empty()) {
+        cerr << "No scene file given" << endl;
+        return false;
+    }
+    if (options.interactive && (options.scenes.size() > 1 || !options.display)) {
+        cerr << "--interactive needs a single scene and the display" << endl;
+        return false;
+    }
+    if (options.workers > 0 && (options.interactive || options.progressive || options.comparePackets
+                                || options.compareFastIntersection)) {
+        cerr << "--workers doesn't go with --interactive, --progressive nor the comparisons" << endl;
+        return false;
+    }
+    if (options.scenes.size() > 1 && !options.output.empty()) {
+        cerr << "--output only applies to a single scene, use --output-dir for a batch" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Where to save the render of the given scene file
+ * @param options
+ * @param scene
+ * @return
+ */
+string outputPath(const Options &options, const string &scene) {
+    if (options.scenes.size() <= 1)
+        return options.output.empty() ? "render.bmp" : options.output;
+
+    // Batch: named after the scene file, without its folder and extension
+    string name = scene.substr(scene.find_last_of("/\\") + 1);
+    name = name.substr(0, name.find_last_of('.')) + "." + options.format;
+    return options.outputDir.empty() ? name : options.outputDir + "/" + name;
+}
+
+
+/**
+ * Output of a frame of a sequence, numbered before the extension: render.bmp gives render_0000.bmp, render_0001.bmp...
+ * @param output
+ * @param frame
+ * @return
+ */
+string framePath(const string &output, int frame) {
+    char number[16];
+    snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = output.find_last_of('.');
+    if (dot == string::npos || dot < output.find_last_of("/\\") + 1)
+        return output + number;
+    return output.substr(0, dot) + number + output.substr(dot);
+}
+
+
+/**
+ * Number of render threads: RAYTRACER_THREADS if set, the number of cores otherwise
+ * @return
+ */
+int threadCount() {
+    const char *env = getenv("RAYTRACER_THREADS");
+    if (env && atoi(env) > 0)
+        return atoi(env);
+
+    int cores = thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+
+#endif //RAYTRACER_OPTIONS_H
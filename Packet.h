@@ -0,0 +1,199 @@
+#include "glm.hpp"
+#include "NeededMath.h"
+#include "SIMD.h"
+
+using namespace std;
+using namespace glm;
+
+#ifndef RAYTRACER_PACKET_H
+#define RAYTRACER_PACKET_H
+
+
+/**
+ * Coherent rays sharing the same origin, one per lane
+ */
+struct RayPacket {
+    static const int SIZE = vfloat::WIDTH;
+
+    // Pixel block covered by a packet
+    static const int BLOCK_W = SIZE == 8 ? 4 : 2;
+    static const int BLOCK_H = 2;
+
+    vec3 origin;
+    vfloat dx, dy, dz;
+    vfloat invX, invY, invZ;
+    vmask active;
+
+    /**
+     * @param origin
+     * @param directions Normalized directions, SIZE of them
+     * @param lanes Number of valid directions, the others lanes are inactive
+     */
+    RayPacket(const vec3 &origin, const vec3 *directions, int lanes) : origin(origin) {
+        float d[3][SIZE], inv[3][SIZE];
+        for (int l = 0; l < SIZE; l++) {
+            // Inactive lanes repeat the first ray to keep the math clean
+            const vec3 &dir = directions[l < lanes ? l : 0];
+
+            for (int a = 0; a < 3; a++) {
+                d[a][l] = dir[a];
+
+                // A huge finite inverse rather than infinity, so that an origin lying on a
+                // box plane gives 0 instead of NaN in the slab test
+                inv[a][l] = dir[a] != 0 ? 1.f / dir[a] : copysign(1e30f, dir[a]);
+            }
+        }
+
+        dx = vfloat::load(d[0]);
+        dy = vfloat::load(d[1]);
+        dz = vfloat::load(d[2]);
+        invX = vfloat::load(inv[0]);
+        invY = vfloat::load(inv[1]);
+        invZ = vfloat::load(inv[2]);
+        active = maskFirst(lanes);
+    }
+
+    /**
+     * Normalize the directions of all lanes at once, the same as normalize() does one by one
+     * @param origin
+     * @param x Components of the directions, not normalized, SIZE of each:
+     *          inactive lanes have to repeat a valid direction
+     * @param y
+     * @param z
+     * @param lanes Number of valid directions
+     */
+    RayPacket(const vec3 &origin, const float *x, const float *y, const float *z, int lanes) : origin(origin) {
+        vfloat vx = vfloat::load(x), vy = vfloat::load(y), vz = vfloat::load(z);
+        vfloat scale = vfloat(1.f) / vsqrt(vx * vx + vy * vy + vz * vz);
+        dx = vx * scale;
+        dy = vy * scale;
+        dz = vz * scale;
+        invX = inverse(dx);
+        invY = inverse(dy);
+        invZ = inverse(dz);
+        active = maskFirst(lanes);
+    }
+
+private:
+    // Same as the first constructor: a huge finite inverse for zero components
+    static vfloat inverse(const vfloat &d) {
+        vfloat inv = vfloat(1.f) / d;
+        return select((d < vfloat(0.f)) | (d > vfloat(0.f)), inv, select(inv > vfloat(0.f), vfloat(1e30f), vfloat(-1e30f)));
+    }
+};
+
+
+/**
+ * Slab test of every lane against the box, within [0, tMax]
+ * @param box
+ * @param rays
+ * @param tMax
+ * @param tNear Entry distance of each lane
+ * @return Lanes hitting the box
+ */
+inline vmask intersectPacket(const AABB &box, const RayPacket &rays, const vfloat &tMax, vfloat &tNear) {
+    vfloat x0 = (vfloat(box.pMin.x) - vfloat(rays.origin.x)) * rays.invX;
+    vfloat x1 = (vfloat(box.pMax.x) - vfloat(rays.origin.x)) * rays.invX;
+    vfloat y0 = (vfloat(box.pMin.y) - vfloat(rays.origin.y)) * rays.invY;
+    vfloat y1 = (vfloat(box.pMax.y) - vfloat(rays.origin.y)) * rays.invY;
+    vfloat z0 = (vfloat(box.pMin.z) - vfloat(rays.origin.z)) * rays.invZ;
+    vfloat z1 = (vfloat(box.pMax.z) - vfloat(rays.origin.z)) * rays.invZ;
+
+    tNear = vmax(vmin(x0, x1), vmax(vmin(y0, y1), vmax(vmin(z0, z1), vfloat(0.f))));
+    vfloat tFar = vmin(vmax(x0, x1), vmin(vmax(y0, y1), vmin(vmax(z0, z1), tMax)));
+
+    return rays.active & (tNear <= tFar * vfloat(1.0000004f));
+}
+
+
+/**
+ * Lanes hitting the front face of the sphere before tHit.
+ * Same solutions as Sphere::intersect: the ray origin being shared, only the projection on the direction varies.
+ *
+ * @param center
+ * @param radiusSquared
+ * @param rays
+ * @param tHit Updated with the new hits
+ * @return
+ */
+inline vmask intersectSpherePacket(const vec3 &center, float radiusSquared, const RayPacket &rays, vfloat &tHit) {
+    vec3 diff = rays.origin - center;
+    float c = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z - radiusSquared;
+
+    vfloat h = rays.dx * vfloat(diff.x) + rays.dy * vfloat(diff.y) + rays.dz * vfloat(diff.z);
+    vfloat delta = h * h - vfloat(c);
+
+    // Only the entering solution is kept, the other one being a backface
+    vfloat t = -h - vsqrt(vmax(delta, vfloat(0.f)));
+    vmask hit = rays.active & (delta > vfloat(0.f)) & (t > vfloat(0.f)) & (t < tHit);
+
+    tHit = select(hit, t, tHit);
+    return hit;
+}
+
+
+/**
+ * Lanes hitting the front of the plane before tHit
+ * @param point
+ * @param n Normal, as given
+ * @param rays
+ * @param tHit Updated with the new hits
+ * @return
+ */
+inline vmask intersectPlanePacket(const vec3 &point, const vec3 &n, const RayPacket &rays, vfloat &tHit) {
+    vec3 diff = rays.origin - point;
+    float numerator = diff.x * n.x + diff.y * n.y + diff.z * n.z;
+
+    vfloat denominator = -(rays.dx * vfloat(n.x) + rays.dy * vfloat(n.y) + rays.dz * vfloat(n.z));
+    vfloat t = vfloat(numerator) / denominator;
+    vmask hit = rays.active & (denominator > vfloat(0.000001f)) & (t > vfloat(0.f)) & (t < tHit);
+
+    tHit = select(hit, t, tHit);
+    return hit;
+}
+
+
+/**
+ * Lanes hitting the front of the triangle before tHit, same Möller–Trumbore test as Mesh::intersect.
+ * The terms depending only on the shared origin are computed once for the whole packet.
+ *
+ * @param v0 First vertex
+ * @param e1 Edges leaving it
+ * @param e2
+ * @param rays
+ * @param tHit Updated with the new hits
+ * @param uHit Updated with the barycentric coordinates of the new hits
+ * @param vHit
+ * @return
+ */
+inline vmask intersectTrianglePacket(const vec3 &v0, const vec3 &e1, const vec3 &e2, const RayPacket &rays, vfloat &tHit,
+                                     vfloat &uHit, vfloat &vHit) {
+    vec3 tvec = rays.origin - v0;
+    vec3 qvec = cross(tvec, e1);
+
+    // pvec = direction x e2
+    vfloat px = rays.dy * vfloat(e2.z) - rays.dz * vfloat(e2.y);
+    vfloat py = rays.dz * vfloat(e2.x) - rays.dx * vfloat(e2.z);
+    vfloat pz = rays.dx * vfloat(e2.y) - rays.dy * vfloat(e2.x);
+
+    vfloat det = px * vfloat(e1.x) + py * vfloat(e1.y) + pz * vfloat(e1.z);
+    vfloat invDet = vfloat(1.f) / det;
+
+    vfloat u = (px * vfloat(tvec.x) + py * vfloat(tvec.y) + pz * vfloat(tvec.z)) * invDet;
+    vfloat v = (rays.dx * vfloat(qvec.x) + rays.dy * vfloat(qvec.y) + rays.dz * vfloat(qvec.z)) * invDet;
+    vfloat t = vfloat(e2.x * qvec.x + e2.y * qvec.y + e2.z * qvec.z) * invDet;
+
+    // Backface culling, then inside test
+    vfloat slack(TRIANGLE_EDGE_SLACK);
+    vmask hit = rays.active & (det > vfloat(0.f))
+                & (u >= -slack) & (v >= -slack) & (u + v <= vfloat(1.f) + slack)
+                & (t > vfloat(0.f)) & (t < tHit);
+
+    tHit = select(hit, t, tHit);
+    uHit = select(hit, u, uHit);
+    vHit = select(hit, v, vHit);
+    return hit;
+}
+
+
+#endif //RAYTRACER_PACKET_H
@@ -0,0 +1,176 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <CImg.h>
+#include "glm.hpp"
+#include "geometry.h"
+#include "Renderer.h"
+
+using namespace std;
+using namespace cimg_library;
+using namespace glm;
+
+#ifndef RAYTRACER_PREVIEW_H
+#define RAYTRACER_PREVIEW_H
+
+
+/**
+ * Window on the render, moving the camera with the keyboard.
+ *
+ * Each frame is refined from a coarse level, one ray per block of pixels, down to every pixel, then supersampled
+ * if the renderer asks for more samples. Levels are rendered by a background thread and shown as they complete.
+ * A key press cancels the frame between two tiles and starts the next one from the coarse level: the scene,
+ * its BVH and the meshes stay as they are, only the camera moves.
+ *
+ * Keys: W / S or up / down arrows move forward and backward, A / D or left / right arrows move sideways,
+ * Q / E or page down / page up move down and up, Esc closes the window.
+ */
+class InteractivePreview {
+    Renderer &renderer;
+    int threads;
+    int coarsestStep = 8;       // Pixels per side of the blocks of the first level
+
+    // The frame being rendered, and the last level completed, shown by the window
+    CImg<float> image, shown;
+    mutex shownLock;
+    atomic<int> shownLevels;    // Levels completed by the current frame
+    string shownState;          // Level in shown, and how long the frame took to get there
+    atomic<bool> cancelled;
+    chrono::steady_clock::time_point frameStart;
+    double firstLevelMs = 0;
+
+public:
+    InteractivePreview(Renderer &renderer, int threads) : renderer(renderer), threads(threads),
+                                                           shownLevels(0), cancelled(false) {}
+
+    /**
+     * Show the window until it is closed
+     * @param title
+     */
+    void run(const string &title) {
+        image.assign(renderer.width, renderer.height, 1, 3, 0);
+        shown = image;
+        renderer.cancel = &cancelled;
+
+        // No normalization: colors are on the 0-255 scale, and coarse levels keep the brightness of the final one
+        CImgDisplay display(renderer.width, renderer.height, title.c_str(), 0);
+        float speed = moveSpeed();
+        int displayedLevels = 0;
+        thread worker = startFrame();
+        auto lastPoll = chrono::steady_clock::now();
+
+        while (!display.is_closed() && !display.is_keyESC()) {
+            auto now = chrono::steady_clock::now();
+            float seconds = chrono::duration<float>(now - lastPoll).count();
+            lastPoll = now;
+
+            vec3 move = keyMove(display);
+            if (move != vec3()) {
+                // Drop the current frame, and render again from the new position
+                cancelled = true;
+                worker.join();
+                // Along the axes of the view, the point looked at moving along
+                Camera &cam = renderer.scene.cam;
+                vec3 right, up, forward;
+                cam.axes(right, up, forward);
+                vec3 step = (right * move.x + up * move.y - forward * move.z) * (speed * glm::min(seconds, 0.1f));
+                cam.position += step;
+                cam.target += step;
+                worker = startFrame();
+                displayedLevels = 0;
+            }
+
+            if (shownLevels != displayedLevels) {
+                lock_guard<mutex> guard(shownLock);
+                displayedLevels = shownLevels;
+                display.display(shown);
+                display.set_title("%s - %s", title.c_str(), shownState.c_str());
+            }
+
+            display.wait(10);
+        }
+
+        cancelled = true;
+        worker.join();
+        renderer.cancel = nullptr;
+    }
+
+private:
+    /**
+     * Start rendering a frame in the background, from the coarse level
+     * @return
+     */
+    thread startFrame() {
+        cancelled = false;
+        shownLevels = 0;
+        frameStart = chrono::steady_clock::now();
+        return thread([this]() { renderFrame(); });
+    }
+
+    void renderFrame() {
+        for (int step = coarsestStep; step >= 1; step /= 2) {
+            if (!renderer.renderLevel(image, threads, step, step < coarsestStep))
+                return;
+            publish(step == 1 ? "1 sample per pixel" : "1/" + to_string(step * step) + " of the pixels");
+        }
+
+        // Supersampled on top, in a frame of its own since render() starts over from the centres of the pixels
+        if (renderer.maxSamples > 1) {
+            CImg<float> sampled(renderer.width, renderer.height, 1, 3, 0);
+            renderer.render(sampled, threads);
+            if (cancelled) return;
+
+            image = sampled;
+            publish(to_string(renderer.maxSamples) + " samples per pixel at most");
+        }
+    }
+
+    /**
+     * Hand a completed level over to the window
+     * @param level What the level is
+     */
+    void publish(const string &level) {
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+        if (shownLevels == 0) firstLevelMs = elapsed;
+
+        char state[128];
+        snprintf(state, sizeof(state), "%s in %.0f ms, first level in %.0f ms", level.c_str(), elapsed, firstLevelMs);
+
+        lock_guard<mutex> guard(shownLock);
+        shown = image;
+        shownState = state;
+        shownLevels++;
+    }
+
+    /**
+     * Direction of the move asked by the keys held, in camera space: x right, y up, -z forward
+     * @param display
+     * @return
+     */
+    static vec3 keyMove(const CImgDisplay &display) {
+        vec3 move = vec3();
+        if (display.is_keyW() || display.is_keyARROWUP()) move.z -= 1;
+        if (display.is_keyS() || display.is_keyARROWDOWN()) move.z += 1;
+        if (display.is_keyA() || display.is_keyARROWLEFT()) move.x -= 1;
+        if (display.is_keyD() || display.is_keyARROWRIGHT()) move.x += 1;
+        if (display.is_keyQ() || display.is_keyPAGEDOWN()) move.y -= 1;
+        if (display.is_keyE() || display.is_keyPAGEUP()) move.y += 1;
+        return move;
+    }
+
+    /**
+     * Distance moved per second a key is held, a quarter of the size of the bounded objects
+     * @return
+     */
+    float moveSpeed() const {
+        AABB bounds = renderer.scene.bvh.bounds();
+        return bounds.isValid() ? glm::max(length(bounds.pMax - bounds.pMin) / 4, 0.1f) : 10.f;
+    }
+};
+
+
+#endif //RAYTRACER_PREVIEW_H
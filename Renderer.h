@@ -0,0 +1,1225 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <CImg.h>
+#include "glm.hpp"
+#include "NeededMath.h"
+#include "geometry.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace cimg_library;
+using namespace glm;
+
+#ifndef RAYTRACER_RENDERER_H
+#define RAYTRACER_RENDERER_H
+
+
+/**
+ * Rectangle of pixels [x0, x1[ x [y0, y1[, in image coordinates
+ */
+struct Tile {
+    int x0, y0, x1, y1;
+};
+
+
+/**
+ * Part of the image held in memory, starting at (x0, y0): the whole image,
+ * or a single tile with a border of pixels around it
+ */
+struct Window {
+    int x0, y0, width, height;
+
+    /**
+     * Index of an image pixel in the buffers of the window
+     * @param x
+     * @param y
+     * @return
+     */
+    int index(int x, int y) const { return (y - y0) * width + (x - x0); }
+};
+
+
+/**
+ * Order the pixels of a tile are traced in, and layout of the colors until the render is complete
+ */
+enum class PixelOrder {
+    ROWS,       // Row after row, written straight into the planar image (a plane per channel)
+    Z_ORDER     // Blocks of 8 x 8 pixels in row order, each one along the Morton curve, colors interleaved
+};
+
+
+/**
+ * Colors of the pixels of a window while they are rendered.
+ *
+ * In Z order, the pixels of each block of 8 x 8 lie along the Morton curve, r, g and b side by side, so that the
+ * pixels a tile traces one after the other are written one after the other, 3 floats in the same cache line, rather
+ * than to 3 planes. Once complete, they are converted to the planar layout of the image in a single pass.
+ * In row order, the colors go straight to the image.
+ */
+class Framebuffer {
+    CImg<float> &image;
+    Window window;
+    PixelOrder order;
+    int blocksPerRow;
+    vector<float> rgb;
+
+public:
+    static const int BLOCK = 8;
+
+    /**
+     * @param image Gets the pixels, window.width x window.height with 3 channels
+     * @param window
+     * @param order
+     */
+    Framebuffer(CImg<float> &image, const Window &window, PixelOrder order)
+            : image(image), window(window), order(order), blocksPerRow((window.width + BLOCK - 1) / BLOCK) {
+        if (order == PixelOrder::Z_ORDER)
+            rgb.resize((size_t) blocksPerRow * ((window.height + BLOCK - 1) / BLOCK) * BLOCK * BLOCK * 3, 0.f);
+    }
+
+    void set(int x, int y, const vec3 &color) {
+        if (order == PixelOrder::ROWS) {
+            image(x - window.x0, y - window.y0, 0, 0) = color.x;
+            image(x - window.x0, y - window.y0, 0, 1) = color.y;
+            image(x - window.x0, y - window.y0, 0, 2) = color.z;
+            return;
+        }
+
+        float *p = &rgb[offset(x - window.x0, y - window.y0)];
+        p[0] = color.x;
+        p[1] = color.y;
+        p[2] = color.z;
+    }
+
+    /**
+     * Write the pixels to the image, once they are all rendered
+     */
+    void finish() {
+        if (order == PixelOrder::ROWS) return;
+
+        for (int y = 0; y < window.height; y++) {
+            for (int x = 0; x < window.width; x++) {
+                const float *p = &rgb[offset(x, y)];
+                image(x, y, 0, 0) = p[0];
+                image(x, y, 0, 1) = p[1];
+                image(x, y, 0, 2) = p[2];
+            }
+        }
+    }
+
+    // Position along the Morton curve of a pixel of a block, the bits of x and y interleaved
+    static int morton(int x, int y) {
+        return (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2 | (x & 4) << 2 | (y & 4) << 3;
+    }
+
+    // Pixel of a block at a position along the Morton curve
+    static int mortonX(int m) { return (m & 1) | (m >> 1 & 2) | (m >> 2 & 4); }
+    static int mortonY(int m) { return (m >> 1 & 1) | (m >> 2 & 2) | (m >> 3 & 4); }
+
+private:
+    size_t offset(int x, int y) const {
+        size_t block = (size_t) (y / BLOCK) * blocksPerRow + x / BLOCK;
+        return (block * BLOCK * BLOCK + morton(x % BLOCK, y % BLOCK)) * 3;
+    }
+};
+
+
+/**
+ * Hands out tiles to the render workers.
+ * Each worker owns a queue holding a contiguous run of tiles and takes from its front.
+ * Once it runs dry, it steals from the back of the other queues, so that expensive
+ * regions of the image don't leave the other threads idle.
+ */
+class TileScheduler {
+    struct Queue {
+        mutex lock;
+        deque<Tile> tiles;
+    };
+
+    vector<unique_ptr<Queue>> queues;
+
+public:
+    TileScheduler(const vector<Tile> &tiles, int workers) {
+        for (int w = 0; w < workers; w++) {
+            queues.emplace_back(new Queue());
+
+            size_t first = tiles.size() * w / workers;
+            size_t last = tiles.size() * (w + 1) / workers;
+            queues[w]->tiles.assign(tiles.begin() + first, tiles.begin() + last);
+        }
+    }
+
+    /**
+     * Get the next tile for the given worker
+     * @param worker
+     * @param tile
+     * @return false once every queue is empty
+     */
+    bool next(int worker, Tile &tile) {
+        {
+            Queue &own = *queues[worker];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tiles.empty()) {
+                tile = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the others, starting with the next worker
+        for (int v = 1; v < queues.size(); v++) {
+            Queue &victim = *queues[(worker + v) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tiles.empty()) {
+                tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+
+/**
+ * Running sums of the samples taken in a pixel
+ */
+struct PixelSamples {
+    vec3 sum;
+    float sumSquares = 0;   // Of the luminance
+    int count = 0;
+    int object = -1;        // Object hit by the first sample, -1 for the background
+    bool mixed = false;     // Samples hit different objects
+
+    void add(const vec3 &color, int hitObject) {
+        if (count == 0) object = hitObject;
+        mixed |= hitObject != object;
+
+        float luminance = (color.x + color.y + color.z) / 3;
+        sum += color;
+        sumSquares += luminance * luminance;
+        count++;
+    }
+
+    vec3 mean() const { return sum / (float) count; }
+
+    /**
+     * Variance of the mean luminance, shrinking as samples are added
+     * @return
+     */
+    float meanVariance() const {
+        float mean = (sum.x + sum.y + sum.z) / (3 * count);
+        float variance = glm::max(sumSquares / count - mean * mean, 0.f);
+        return variance / count;
+    }
+};
+
+
+/**
+ * Outcome of a render
+ */
+struct RenderStats {
+    long long samples = 0;      // Primary rays shot
+    int passes = 1;
+    bool complete = true;       // False if the time budget cut the refinement short
+};
+
+
+/**
+ * Shoots the rays of the camera through the scene and shades the hits
+ */
+class Renderer {
+public:
+    Scene &scene;
+    int width, height;
+    int tileSize = 32;
+
+    // Size of a pixel on the focal plane, 1 unless the resolution is overridden
+    float pixelScale = 1.f;
+
+    // Distance from the camera to the focal plane, in pixels of the camera's own resolution
+    float focalLength = 1.f;
+
+    // Trace the primary rays by SIMD packets rather than one at a time
+    bool usePackets = false;
+
+    // Order of the pixels in a tile, Z order keeping the rays traced one after the other close on the image
+    PixelOrder pixelOrder = PixelOrder::Z_ORDER;
+
+    // Supersampling. Every pixel first gets a ray through its centre; with maxSamples > 1, the pixels on an edge
+    // between objects or contrasting with a neighbour get at least minSamples, and more while their samples
+    // still hit different objects or their mean is uncertain by more than threshold.
+    int maxSamples = 1;
+    int minSamples = 4;
+    float threshold = 4.f;      // On the 0-255 scale
+
+    // Reflections and refractions: bounces after the primary hit, and weight under which a secondary ray is dropped,
+    // half a step of the 0-255 scale by default
+    int maxDepth = 5;
+    float minContribution = 0.5f / 255;
+
+    // Refine the whole image over passes of growing sample counts, rather than each pixel at once,
+    // stopping once timeBudget seconds are spent (0 for no limit)
+    bool progressive = false;
+    double timeBudget = 0;
+
+    // Work done by the last render, counted while RayCounters::enabled()
+    RayCounters counters;
+
+    // Once set, the workers leave the remaining tiles of the render, for an interactive preview to restart it
+    const atomic<bool> *cancel = nullptr;
+
+    /**
+     * @param scene
+     * @param outWidth Output resolution, 0 to use the one given by the camera
+     * @param outHeight
+     */
+    Renderer(Scene &scene, int outWidth = 0, int outHeight = 0) : scene(scene) {
+        // Here FOV has been loaded and converted to radians already.
+        const Camera &cam = scene.cam;
+        if (cam.width > 0 && cam.height > 0) {
+            width = cam.width;
+            height = cam.height;
+            focalLength = height / (2 * tan(cam.fov / 2));
+        } else {
+            height = tan(cam.fov / 2) * 2 * cam.focalLength;
+            width = cam.aspectRatio * height;
+            focalLength = cam.focalLength;
+        }
+
+        // Keep the vertical field of view, with square pixels
+        if (outWidth > 0 && outHeight > 0) {
+            pixelScale = (float) height / outHeight;
+            width = outWidth;
+            height = outHeight;
+        }
+        aim();
+    }
+
+    /**
+     * Set the rays up for where the camera looks, once it moved.
+     * Done by every render: a camera looking at a point turns as it moves.
+     */
+    void aim() {
+        vec3 right, up, forward;
+        scene.cam.axes(right, up, forward);
+        centre = forward * focalLength;
+        columnStep = right * pixelScale;
+        rowStep = up * pixelScale;
+
+        columnSteps.resize(width);
+        for (int x = 0; x < width; x++)
+            columnSteps[x] = columnStep * (float) (x - width / 2);
+    }
+
+    /**
+     * Render the whole image with the given number of threads.
+     * Every worker writes its own tiles directly into the image, pixels never being shared,
+     * so the result is the same whatever the thread count (unless a time budget cuts it short).
+     *
+     * @param image Has to be width x height, with 3 channels
+     * @param threads
+     * @return
+     */
+    RenderStats render(CImg<float> &image, int threads) {
+        RenderStats stats;
+        counters = RayCounters();
+        aim();
+        vector<Tile> tiles = makeTiles();
+        Window frame = {0, 0, width, height};
+        Framebuffer buffer(image, frame, pixelOrder);
+
+        if (maxSamples <= 1) {
+            forEachTile(tiles, threads, [&](const Tile &tile) { renderTile(buffer, frame, tile, nullptr); });
+            buffer.finish();
+            stats.samples = (long long) (width / 2) * 2 * (height / 2) * 2;
+            return stats;
+        }
+
+        auto start = chrono::steady_clock::now();
+        auto outOfTime = [&]() {
+            return timeBudget > 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() > timeBudget;
+        };
+
+        // First pass: the centre of every pixel, the same as without supersampling
+        vector<PixelSamples> pixels(width * height);
+        forEachTile(tiles, threads, [&](const Tile &tile) { renderTile(buffer, frame, tile, pixels.data()); });
+
+        // Then refine the pixels on edges, judged on the first pass
+        vector<uint8_t> refine(width * height, 0);
+        forEachTile(tiles, threads, [&](const Tile &tile) { findEdges(pixels, frame, tile, refine); });
+
+        atomic<long long> samples(0);
+        int target = progressive ? glm::min(minSamples, maxSamples) : maxSamples;
+        while (true) {
+            atomic<bool> cut(false);
+            atomic<long long> refined(0);
+
+            forEachTile(tiles, threads, [&](const Tile &tile) {
+                if (progressive && outOfTime()) {
+                    cut = true;
+                    return;
+                }
+                long long tileSamples = 0, tileRefined = 0;
+                refineTile(buffer, frame, tile, pixels, refine, target, tileSamples, tileRefined);
+                samples += tileSamples;
+                refined += tileRefined;
+            });
+
+            stats.passes++;
+            if (cut) {
+                stats.complete = false;
+                break;
+            }
+            if (refined == 0 || target >= maxSamples)
+                break;
+            target = glm::min(target * 2, maxSamples);
+        }
+
+        buffer.finish();
+        stats.samples = samples + (long long) (width / 2) * 2 * (height / 2) * 2;
+        return stats;
+    }
+
+    /**
+     * Render the given tiles, handing each one over once finished rather than keeping the whole image.
+     * Memory is only held by the tiles being rendered, whatever the size of the image.
+     * With supersampling, each tile is traced with a border of one pixel for the edge detection, and refined
+     * to maxSamples at once: the pixels are the same as the ones of render() outside of the progressive mode.
+     *
+     * @param tiles Some of makeTiles()
+     * @param threads
+     * @param done Called by the workers with each tile, its pixels on the 0-255 scale and their window.
+     *             Returns false to stop the render.
+     * @return Complete unless done stopped it
+     */
+    template<typename Done>
+    RenderStats renderTiles(const vector<Tile> &tiles, int threads, Done &&done) {
+        RenderStats stats;
+        counters = RayCounters();
+        aim();
+        atomic<long long> samples(0);
+        atomic<bool> stopped(false);
+        int renderWidth = (width / 2) * 2;
+        int renderHeight = (height / 2) * 2;
+
+        forEachTile(tiles, threads, [&](const Tile &tile) {
+            if (stopped) return;
+
+            int border = maxSamples > 1 ? 1 : 0;
+            Tile bordered = {glm::max(tile.x0 - border, 0), glm::max(tile.y0 - border, 0),
+                             glm::min(tile.x1 + border, renderWidth), glm::min(tile.y1 + border, renderHeight)};
+            Window window = {bordered.x0, bordered.y0, bordered.x1 - bordered.x0, bordered.y1 - bordered.y0};
+            CImg<float> image(window.width, window.height, 1, 3, 0);
+            Framebuffer buffer(image, window, pixelOrder);
+            long long tileSamples = (long long) (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+
+            if (maxSamples <= 1) {
+                renderTile(buffer, window, tile, nullptr);
+            } else {
+                vector<PixelSamples> pixels(window.width * window.height);
+                vector<uint8_t> refine(window.width * window.height, 0);
+                long long refined = 0;
+                renderTile(buffer, window, bordered, pixels.data());
+                findEdges(pixels, window, tile, refine);
+                refineTile(buffer, window, tile, pixels, refine, maxSamples, tileSamples, refined);
+            }
+            buffer.finish();
+
+            samples += tileSamples;
+            if (!done(tile, image, window))
+                stopped = true;
+        });
+
+        stats.samples = samples;
+        stats.complete = !stopped;
+        return stats;
+    }
+
+    /**
+     * Level of a preview: one ray per block of step x step pixels, its color filling the block.
+     * Blocks already traced by the level of twice the step are left as they are, so that going
+     * from a coarse step down to 1 traces each pixel once, and ends with the image of render() without supersampling.
+     *
+     * @param image
+     * @param threads
+     * @param step Power of 2, up to tileSize
+     * @param refining The level of twice the step is in the image
+     * @return false if cancelled before the end
+     */
+    bool renderLevel(CImg<float> &image, int threads, int step, bool refining) {
+        counters = RayCounters();
+        aim();
+        Window frame = {0, 0, width, height};
+
+        forEachTile(makeTiles(), threads, [&](const Tile &tile) {
+            long long tileRays = 0;
+            for (int y = tile.y0; y < tile.y1; y += step) {
+                vec3 row = rowDirection(y);
+                for (int x = tile.x0; x < tile.x1; x += step) {
+                    if (refining && x % (step * 2) == 0 && y % (step * 2) == 0)
+                        continue;
+
+                    Ray ray = pixelRay(row, x);
+                    vec3 color = shade(ray, scene.closestHit(ray));
+                    for (int by = y; by < glm::min(y + step, tile.y1); by++) {
+                        for (int bx = x; bx < glm::min(x + step, tile.x1); bx++)
+                            setPixel(image, frame, bx, by, color);
+                    }
+                    tileRays++;
+                }
+            }
+            RayCounters::count(&RayCounters::primaryRays, tileRays);
+        });
+
+        return !(cancel && *cancel);
+    }
+
+    /**
+     * Split the image in tiles, in row order.
+     * The ray grid is symmetric around the view axis: with an odd size, the last row or column is left black.
+     * @return
+     */
+    vector<Tile> makeTiles() const {
+        int renderWidth = (width / 2) * 2;
+        int renderHeight = (height / 2) * 2;
+
+        vector<Tile> tiles;
+        for (int y = 0; y < renderHeight; y += tileSize) {
+            for (int x = 0; x < renderWidth; x += tileSize) {
+                tiles.push_back({x, y, glm::min(x + tileSize, renderWidth), glm::min(y + tileSize, renderHeight)});
+            }
+        }
+        return tiles;
+    }
+
+    /**
+     * Position of a tile in makeTiles()
+     * @param tile
+     * @return
+     */
+    int tileIndex(const Tile &tile) const {
+        int columns = ((width / 2) * 2 + tileSize - 1) / tileSize;
+        return tile.y0 / tileSize * columns + tile.x0 / tileSize;
+    }
+
+    /**
+     * Shade the pixel hit by the ray going through (i, j) on the focal plane.
+     * Returns black if nothing is hit.
+     *
+     * @param i
+     * @param j
+     * @return
+     */
+    vec3 shadePixel(int i, int j) const {
+        Ray ray = primaryRay(i, j);
+
+        // Find the closest object through the BVH
+        return shade(ray, scene.closestHit(ray));
+    }
+
+    /**
+     * Ray from the camera going through (i, j) on the focal plane, pixel centres being on integer coordinates
+     * @param i
+     * @param j
+     * @return
+     */
+    Ray primaryRay(float i, float j) const {
+        return Ray(scene.cam.position, normalize(centre + rowStep * j + columnStep * i));
+    }
+
+    /**
+     * Direction from the camera to the middle of a row of pixels, not normalized.
+     * Adding columnSteps gives the one of each pixel, the same as primaryRay.
+     * @param y
+     * @return
+     */
+    vec3 rowDirection(int y) const {
+        return centre + rowStep * (float) (height / 2 - y);
+    }
+
+    /**
+     * Ray from the camera through the centre of a pixel
+     * @param row rowDirection of the pixel's row
+     * @param x
+     * @return
+     */
+    Ray pixelRay(const vec3 &row, int x) const {
+        return Ray(scene.cam.position, normalize(row + columnSteps[x]));
+    }
+
+    /**
+     * Color seen along a ray: Phong shading of its closest hit, lit by the lights it can see,
+     * plus what is seen through the reflections and refractions of the surfaces.
+     * Returns black if nothing was hit.
+     *
+     * Secondary rays are traced depth first from a fixed size stack, weighted by their share of the pixel.
+     * They stop after maxDepth bounces, or as soon as their weight falls under minContribution.
+     *
+     * @param ray
+     * @param hit
+     * @return Color on the 0-255 scale
+     */
+    vec3 shade(const Ray &ray, const Hit &hit) const {
+        // Left uninitialized, most pixels never spawning a secondary ray
+        typename aligned_storage<sizeof(PendingRay), alignof(PendingRay)>::type stackMemory[RAY_STACK_SIZE];
+        PendingRay *stack = reinterpret_cast<PendingRay *>(stackMemory);
+        int sp = 0;
+
+        vec3 pixelColor = vec3();
+        Ray current = ray;
+        Hit currentHit = hit;
+        float weight = 1.f;
+        int depth = 0;
+        float travelled = 0;    // From the camera to the origin of the current ray
+        int secondaryRays = 0;
+
+        while (true) {
+            // Color pixel at calculated intersection
+            if (currentHit.t < INFINITY) {
+                // The textures looked up only for the materials having some
+                const Material &base = scene.materialOf(currentHit);
+                Material textured;
+                const Material &material = base.textured() ? (textured = texturedMaterial(current, currentHit, base, travelled + currentHit.t))
+                                                           : base;
+
+                // Intersection world coord and normals, for the closest hit only
+                SurfacePoint surface = scene.surfaceAt(current, currentHit);
+                const vec3 &pointIntersect = surface.point;
+
+                float opaque = 1.f - material.reflectivity - material.transmission;
+                if (opaque > 0)
+                    pixelColor += phong(current, surface, material, weight * opaque) * (weight * opaque);
+
+                if (depth < maxDepth && (material.reflectivity > 0 || material.transmission > 0)) {
+                    // Normals on the side the ray comes from: the geometric one tells the side and moves the
+                    // new rays off the surface, the shading one bends them
+                    bool inside = dot(current.direction, surface.unitNormal) > 0;
+                    vec3 offset = inside ? -surface.unitNormal : surface.unitNormal;
+                    vec3 normal = inside ? -surface.shadingNormal : surface.shadingNormal;
+
+                    float reflected = material.reflectivity;
+                    float cosIn = -dot(current.direction, normal);
+                    if (cosIn < 0) cosIn = 0;   // Shading normal turned away from the ray, near the silhouettes
+
+                    // Refraction, shared with the reflection according to Fresnel (Schlick's approximation)
+                    if (material.transmission > 0) {
+                        float eta = inside ? material.ior : 1.f / material.ior;
+                        float k = 1.f - eta * eta * (1.f - cosIn * cosIn);
+
+                        if (k < 0) {
+                            // Total internal reflection
+                            reflected += material.transmission;
+                        } else {
+                            float cosOut = std::sqrt(k);
+                            float r0 = (1.f - material.ior) / (1.f + material.ior);
+                            r0 *= r0;
+                            float fresnel = r0 + (1.f - r0) * (float) pow(1.f - (inside ? cosOut : cosIn), 5);
+                            reflected += material.transmission * fresnel;
+
+                            Ray refractedRay(pointIntersect - offset * SECONDARY_BIAS,
+                                             normalize(current.direction * eta + normal * (eta * cosIn - cosOut)));
+                            refractedRay.backfaces = !inside;
+                            push(stack, sp, refractedRay, weight * material.transmission * (1.f - fresnel), depth + 1,
+                                 travelled + currentHit.t);
+                        }
+                    }
+
+                    if (reflected > 0) {
+                        Ray reflectedRay(pointIntersect + offset * SECONDARY_BIAS, reflect(current.direction, normal));
+                        reflectedRay.backfaces = inside;
+                        push(stack, sp, reflectedRay, weight * reflected, depth + 1, travelled + currentHit.t);
+                    }
+                }
+            }
+
+            if (sp == 0)
+                break;
+
+            // Next secondary ray
+            sp--;
+            current = stack[sp].ray;
+            weight = stack[sp].weight;
+            depth = stack[sp].depth;
+            travelled = stack[sp].travelled;
+            currentHit = scene.closestHit(current);
+            secondaryRays++;
+        }
+        RayCounters::count(&RayCounters::secondaryRays, secondaryRays);
+
+        // Scale and clamp color
+        pixelColor = pixelColor * 255.f;
+        clampColor(pixelColor);
+        return pixelColor;
+    }
+
+    /**
+     * Phong shading of a hit, lit by the lights it can see.
+     * Lights whose share can't make a visible difference to the pixel are skipped without a shadow ray.
+     *
+     * @param ray
+     * @param surface Of the hit
+     * @param material
+     * @param weight Share of the pixel color
+     * @return Ambient + diffuse + specular, unclamped
+     */
+    vec3 phong(const Ray &ray, const SurfacePoint &surface, const Material &material, float weight) const {
+        vec3 result = vec3();    // Will contain the diffuse + specular contributions of the lights
+        vector<Hit> &lastOccluders = occluderCache();
+
+        // Same for every light
+        float bias = 0.001f;
+        const vec3 &pointIntersect = surface.point;
+        const vec3 &unitNormal = surface.shadingNormal;
+        vec3 shadowOrigin = pointIntersect + surface.normal * bias;
+
+        // Under this, a light stays invisible even summed with all the others
+        float visible = minContribution / (weight * scene.lights.size());
+        int skipped = 0;
+
+        // Cast shadow rays
+        for (int l = 0; l < scene.lights.size(); l++) {
+            Light *light = scene.lights[l];
+
+            if (light->isArea()) {
+                result += areaLight(*light, ray, material, pointIntersect, unitNormal, shadowOrigin, visible,
+                                    lastOccluders[l], skipped);
+                continue;
+            }
+
+            vec3 shadowDir = light->position - pointIntersect;
+            Ray shadowRay = Ray(shadowOrigin, normalize(shadowDir) );
+
+            vec3 diffuse, specular;
+            lightShare(*light, ray, material, unitNormal, shadowRay.direction, diffuse, specular);
+
+            vec3 contribution = diffuse + specular;
+            if (glm::max(contribution.x, glm::max(contribution.y, contribution.z)) < visible) {
+                skipped++;
+                continue;
+            }
+
+            // Check if in shadow or not, up to the light
+            float lightDistance = length(light->position - shadowOrigin);
+            bool lit = !scene.isOccluded(shadowRay, lightDistance, &lastOccluders[l]);
+
+            // If still considered in the light
+            if (lit) {
+                result += diffuse;
+                result += specular;
+            }
+        }
+
+        RayCounters::count(&RayCounters::lightsSkipped, skipped);
+
+        // Adding ambient + result
+        return material.ambient + result;
+    }
+
+private:
+    // Shadow rays an area light takes at a point before looking whether they agree
+    static const int AREA_LIGHT_PROBES = 4;
+
+    // Secondary rays waiting to be traced, a ray spawning at most 2 others
+    static const int RAY_STACK_SIZE = 64;
+    static constexpr float SECONDARY_BIAS = 0.001f;
+
+    // Set by aim(): the ray through pixel (x, y) goes along centre + rowStep * j + columnStep * i,
+    // (i, j) being the pixel relative to the centre of the image, y up. columnSteps holds columnStep * i of each column,
+    // so that a pixel costs one addition to the direction of its row.
+    vec3 centre = vec3(), columnStep = vec3(), rowStep = vec3();
+    vector<vec3> columnSteps;
+
+    /**
+     * Phong diffuse and specular terms of a light, unshadowed
+     * @param light
+     * @param ray Looking at the point
+     * @param material
+     * @param unitNormal
+     * @param lightDir Normalized, from the point to the light
+     * @param diffuse
+     * @param specular
+     */
+    static void lightShare(const Light &light, const Ray &ray, const Material &material, const vec3 &unitNormal,
+                           const vec3 &lightDir, vec3 &diffuse, vec3 &specular) {
+        // Computing Phong Model
+        vec3 light_reflection = reflect(normalize(-lightDir), unitNormal);
+        vec3 diffuseCoef = material.diffuse * (float)glm::max(dot(unitNormal, normalize(lightDir) ), 0.0);
+        vec3 specularCoef = material.specular * (float)pow(glm::max(dot(light_reflection, -ray.direction), 0.0), material.shininess);
+        diffuse = light.diffuseColor * diffuseCoef;
+        specular = light.specularColor * specularCoef;
+    }
+
+    /**
+     * Diffuse and specular share of a rectangle or sphere light, averaged over up to light.samples points of it.
+     *
+     * The points follow the (2, 3) Halton sequence over the light, shifted by an offset of the point lit so that
+     * neighbours don't share the same pattern. The first AREA_LIGHT_PROBES of them already cover the whole light:
+     * when their shadow rays agree, the point is taken to be fully lit or fully in the shadow, and the
+     * other samples go without a shadow ray. Only the points of the penumbra pay for every sample.
+     * Samples too faint to be seen are left out, as whole point lights are.
+     *
+     * @param light
+     * @param ray
+     * @param material
+     * @param pointIntersect
+     * @param unitNormal
+     * @param shadowOrigin
+     * @param visible Contribution under which a sample can't be seen
+     * @param lastOccluder Of the light, for the calling thread
+     * @param skipped Incremented if the whole light was too faint to need a shadow ray
+     * @return
+     */
+    vec3 areaLight(const Light &light, const Ray &ray, const Material &material, const vec3 &pointIntersect,
+                   const vec3 &unitNormal, const vec3 &shadowOrigin, float visible, Hit &lastOccluder, int &skipped) const {
+        int count = glm::max(1, light.samples);
+        int probes = glm::min(count, AREA_LIGHT_PROBES);
+        uint32_t hash = pointHash(pointIntersect);
+        float shiftU = (hash & 0xffff) / 65536.f, shiftV = (hash >> 16) / 65536.f;
+
+        vec3 sum = vec3();
+        int traced = 0, lit = 0, unshadowed = 0;
+        bool agreed = false;
+
+        for (int s = 0; s < count; s++) {
+            float u = radicalInverse(s, 2) + shiftU;
+            float v = radicalInverse(s, 3) + shiftV;
+            vec3 target = light.samplePoint(pointIntersect, u - std::floor(u), v - std::floor(v));
+            Ray shadowRay(shadowOrigin, normalize(target - pointIntersect));
+
+            vec3 diffuse, specular;
+            lightShare(light, ray, material, unitNormal, shadowRay.direction, diffuse, specular);
+            vec3 contribution = diffuse + specular;
+            if (glm::max(contribution.x, glm::max(contribution.y, contribution.z)) < visible)
+                continue;
+
+            // The first shadow rays agree: the rest of the light is seen the same way
+            if (!agreed && traced == probes && (lit == 0 || lit == traced)) {
+                if (lit == 0) {
+                    unshadowed += count - s;
+                    break;
+                }
+                agreed = true;
+            }
+            if (agreed) {
+                sum += contribution;
+                unshadowed++;
+                continue;
+            }
+
+            traced++;
+            if (!scene.isOccluded(shadowRay, length(target - shadowOrigin), &lastOccluder)) {
+                sum += contribution;
+                lit++;
+            }
+        }
+
+        if (traced == 0) skipped++;
+        RayCounters::count(&RayCounters::shadowSamplesSkipped, unshadowed);
+        return sum * (1.f / count);
+    }
+
+    /**
+     * Material of a hit with its texture maps applied, filtered over what a pixel covers at that distance.
+     * Only meshes have texture coordinates: other objects keep the colors of the material.
+     *
+     * @param ray
+     * @param hit
+     * @param material Having maps
+     * @param distance Along the rays, from the camera to the hit
+     * @return
+     */
+    Material texturedMaterial(const Ray &ray, const Hit &hit, const Material &material, float distance) const {
+        Material surface = material;
+        if (hit.type != Hit::TRIANGLE) return surface;
+        const MeshInstance &instance = scene.instances[hit.mesh];
+        const Mesh &mesh = scene.meshes[instance.mesh];
+        if (!mesh.hasUVs()) return surface;
+
+        // Width of the pixel at the hit, stretched along the surface as it turns away from the ray,
+        // then from the scene to the texture by the ratio of the areas of the triangle
+        vec3 side = cross(instance.linear * mesh.edge1(hit.index), instance.linear * mesh.edge2(hit.index));
+        float area = 0.5f * length(side);
+        float facing = std::abs((float) dot(ray.direction, side)) / glm::max(2 * area, 1e-12f);
+        float footprint = distance * pixelScale / focalLength / glm::max(facing, 0.05f)
+                          * std::sqrt(mesh.uvArea(hit.index) / glm::max(area, 1e-12f));
+
+        vec2 uv = mesh.uvAt(hit.index, hit.u, hit.v);
+        if (material.diffuseMap >= 0) {
+            vec3 color = scene.textures->sample(material.diffuseMap, uv, footprint);
+            surface.ambient *= color;
+            surface.diffuse *= color;
+        }
+        if (material.specularMap >= 0)
+            surface.specular *= scene.textures->sample(material.specularMap, uv, footprint);
+        return surface;
+    }
+
+    /**
+     * Hash of a point, to decorrelate the samples of neighbouring points
+     * @param p
+     * @return
+     */
+    static uint32_t pointHash(const vec3 &p) {
+        uint32_t bits[3];
+        memcpy(bits, &p, sizeof(bits));
+        uint32_t hash = bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+        return hash;
+    }
+
+    /**
+     * Last object found between a point and each light by the calling thread, tested first for the next point.
+     * Only a hint: it is checked like any other object, so a stale one can't give a wrong shadow.
+     * @return
+     */
+    vector<Hit> &occluderCache() const {
+        static thread_local const Scene *cachedScene = nullptr;
+        static thread_local vector<Hit> lastOccluders;
+
+        if (cachedScene != &scene || lastOccluders.size() != scene.lights.size()) {
+            cachedScene = &scene;
+            lastOccluders.assign(scene.lights.size(), Hit());
+        }
+        return lastOccluders;
+    }
+
+    struct PendingRay {
+        Ray ray;
+        float weight;   // Share of the pixel color
+        int depth;
+        float travelled;
+    };
+
+    /**
+     * Queue a secondary ray, unless its contribution is too small to be seen or the stack is full
+     * @param stack
+     * @param sp
+     * @param ray
+     * @param weight
+     * @param depth
+     * @param travelled Distance from the camera to its origin
+     */
+    void push(PendingRay stack[], int &sp, const Ray &ray, float weight, int depth, float travelled) const {
+        if (weight < minContribution || sp == RAY_STACK_SIZE)
+            return;
+        new(&stack[sp++]) PendingRay{ray, weight, depth, travelled};
+    }
+
+    /**
+     * Run the work on every tile, spread over the threads.
+     * The counters of each worker are added to the ones of the render once it is done.
+     * @param tiles
+     * @param threads
+     * @param work
+     */
+    template<typename Work>
+    void forEachTile(const vector<Tile> &tiles, int threads, Work &&work) {
+        threads = glm::max(1, glm::min(threads, (int) tiles.size()));
+        TileScheduler scheduler(tiles, threads);
+        mutex countersLock;
+
+        auto worker = [&](int w) {
+            RayCounters::local() = RayCounters();
+
+            Tile tile;
+            while (!(cancel && *cancel) && scheduler.next(w, tile))
+                work(tile);
+
+            if (RayCounters::enabled()) {
+                lock_guard<mutex> guard(countersLock);
+                counters.add(RayCounters::local());
+            }
+        };
+
+        vector<thread> pool;
+        for (int w = 1; w < threads; w++)
+            pool.emplace_back(worker, w);
+        worker(0);
+
+        for (thread &t : pool)
+            t.join();
+    }
+
+    /**
+     * Object of the scene hit, meshes counting as one object
+     * @param hit
+     * @return -1 for the background
+     */
+    int objectOf(const Hit &hit) const {
+        return hit.t == INFINITY ? -1 : scene.objectIndex(hit);
+    }
+
+    void setPixel(CImg<float> &image, const Window &window, int x, int y, const vec3 &color) const {
+        image(x - window.x0, y - window.y0, 0, 0) = color.x;
+        image(x - window.x0, y - window.y0, 0, 1) = color.y;
+        image(x - window.x0, y - window.y0, 0, 2) = color.z;
+    }
+
+    /**
+     * Trace the centre of each pixel of the tile
+     * @param buffer Pixels of the window
+     * @param window Holding the tile
+     * @param tile
+     * @param pixels If not null, gets the sample too, indexed like the window
+     */
+    void renderTile(Framebuffer &buffer, const Window &window, const Tile &tile, PixelSamples *pixels) const {
+        if (usePackets) {
+            renderTilePackets(buffer, window, tile, pixels);
+            return;
+        }
+
+        forEachPixel(tile, [&](int x, int y, const vec3 &row) {
+            // Paint the pixel
+            Ray ray = pixelRay(row, x);
+            Hit hit = scene.closestHit(ray);
+            vec3 pixelColor = shade(ray, hit);
+            buffer.set(x, y, pixelColor);
+            if (pixels)
+                pixels[window.index(x, y)].add(pixelColor, objectOf(hit));
+        });
+        RayCounters::count(&RayCounters::primaryRays, (long long) (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+    }
+
+    /**
+     * Visit the pixels of a tile in pixelOrder
+     * @param tile
+     * @param visit Called with x, y and the rowDirection of y
+     */
+    template<typename Visit>
+    void forEachPixel(const Tile &tile, Visit &&visit) const {
+        if (pixelOrder == PixelOrder::ROWS) {
+            for (int y = tile.y0; y < tile.y1; y++) {
+                vec3 row = rowDirection(y);
+                for (int x = tile.x0; x < tile.x1; x++)
+                    visit(x, y, row);
+            }
+            return;
+        }
+
+        // Blocks aligned on the image, clipped to the tile
+        const int B = Framebuffer::BLOCK;
+        for (int blockY = tile.y0 / B * B; blockY < tile.y1; blockY += B) {
+            vec3 rows[B];
+            for (int r = 0; r < B; r++)
+                rows[r] = rowDirection(blockY + r);
+
+            for (int blockX = tile.x0 / B * B; blockX < tile.x1; blockX += B) {
+                for (int m = 0; m < B * B; m++) {
+                    int x = blockX + Framebuffer::mortonX(m), y = blockY + Framebuffer::mortonY(m);
+                    if (x >= tile.x0 && x < tile.x1 && y >= tile.y0 && y < tile.y1)
+                        visit(x, y, rows[y - blockY]);
+                }
+            }
+        }
+    }
+
+    /**
+     * Same as renderTile, tracing blocks of pixels as one packet.
+     * In Z order, a packet takes the next pixels along the Morton curve of a block, a square (4 lanes)
+     * or two side by side (8 lanes).
+     *
+     * @param buffer
+     * @param window
+     * @param tile
+     * @param pixels
+     */
+    void renderTilePackets(Framebuffer &buffer, const Window &window, const Tile &tile, PixelSamples *pixels) const {
+        const int SIZE = RayPacket::SIZE;
+        int pixelX[SIZE], pixelY[SIZE];
+        float x[SIZE], y[SIZE], z[SIZE];
+        int lanes = 0;
+
+        auto add = [&](int imgX, int imgY, const vec3 &row) {
+            vec3 direction = row + columnSteps[imgX];
+            pixelX[lanes] = imgX;
+            pixelY[lanes] = imgY;
+            x[lanes] = direction.x;
+            y[lanes] = direction.y;
+            z[lanes] = direction.z;
+            lanes++;
+        };
+
+        auto trace = [&]() {
+            if (lanes == 0) return;
+            for (int l = lanes; l < SIZE; l++) {
+                x[l] = x[0];
+                y[l] = y[0];
+                z[l] = z[0];
+            }
+
+            // The directions are normalized by the packet
+            RayPacket rays(scene.cam.position, x, y, z, lanes);
+            Hit hits[SIZE];
+            scene.closestHitPacket(rays, hits);
+            rays.dx.store(x);
+            rays.dy.store(y);
+            rays.dz.store(z);
+
+            // Shade each lane on its own
+            for (int l = 0; l < lanes; l++) {
+                vec3 pixelColor = shade(Ray(scene.cam.position, vec3(x[l], y[l], z[l])), hits[l]);
+                buffer.set(pixelX[l], pixelY[l], pixelColor);
+                if (pixels)
+                    pixels[window.index(pixelX[l], pixelY[l])].add(pixelColor, objectOf(hits[l]));
+            }
+            lanes = 0;
+        };
+
+        if (pixelOrder == PixelOrder::ROWS) {
+            // Gather the pixels of the block inside the tile
+            for (int blockY = tile.y0; blockY < tile.y1; blockY += RayPacket::BLOCK_H) {
+                for (int blockX = tile.x0; blockX < tile.x1; blockX += RayPacket::BLOCK_W) {
+                    for (int imgY = blockY; imgY < glm::min(blockY + RayPacket::BLOCK_H, tile.y1); imgY++) {
+                        vec3 row = rowDirection(imgY);
+                        for (int imgX = blockX; imgX < glm::min(blockX + RayPacket::BLOCK_W, tile.x1); imgX++)
+                            add(imgX, imgY, row);
+                    }
+                    trace();
+                }
+            }
+        } else {
+            // The pixels come along the curve: a packet is full every SIZE of them, unless the tile clips the block
+            forEachPixel(tile, [&](int imgX, int imgY, const vec3 &row) {
+                add(imgX, imgY, row);
+                if (lanes == SIZE ||
+                    Framebuffer::morton(imgX % Framebuffer::BLOCK, imgY % Framebuffer::BLOCK) % SIZE == SIZE - 1)
+                    trace();
+            });
+            trace();
+        }
+        RayCounters::count(&RayCounters::primaryRays, (long long) (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+    }
+
+    /**
+     * Flag the pixels of the tile whose first sample hit another object than a neighbour,
+     * or differs from it by more than the threshold
+     * @param pixels Indexed like the window
+     * @param window Holding the tile and its neighbours
+     * @param tile
+     * @param refine
+     */
+    void findEdges(const vector<PixelSamples> &pixels, const Window &window, const Tile &tile, vector<uint8_t> &refine) const {
+        int renderWidth = (width / 2) * 2;
+        int renderHeight = (height / 2) * 2;
+        int lastX = glm::min(renderWidth, window.x0 + window.width) - 1;
+        int lastY = glm::min(renderHeight, window.y0 + window.height) - 1;
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                const PixelSamples &px = pixels[window.index(x, y)];
+                bool edge = false;
+
+                for (int ny = glm::max(y - 1, window.y0); ny <= glm::min(y + 1, lastY) && !edge; ny++) {
+                    for (int nx = glm::max(x - 1, window.x0); nx <= glm::min(x + 1, lastX) && !edge; nx++) {
+                        const PixelSamples &neighbour = pixels[window.index(nx, ny)];
+                        vec3 diff = abs(neighbour.sum - px.sum);
+                        edge = neighbour.object != px.object || glm::max(diff.x, glm::max(diff.y, diff.z)) > threshold;
+                    }
+                }
+                refine[window.index(x, y)] = edge;
+            }
+        }
+    }
+
+    /**
+     * Should the pixel get more samples
+     * @param px
+     * @param target Sample count to reach at most in this pass
+     * @return
+     */
+    bool needsSamples(const PixelSamples &px, int target) const {
+        if (px.count >= target) return false;
+        if (px.count < minSamples) return true;
+        return px.mixed || px.meanVariance() > threshold * threshold;
+    }
+
+    /**
+     * Sample the flagged pixels of the tile until they are converged or reach target samples.
+     * Pixels still needing samples afterwards stay flagged for the next pass.
+     *
+     * @param buffer Gets the mean of the refined pixels
+     * @param window Holding the tile, indexing the pixels and flags
+     * @param tile
+     * @param pixels
+     * @param refine
+     * @param target
+     * @param samples Incremented with the rays shot
+     * @param refined Incremented with the pixels sampled
+     */
+    void refineTile(Framebuffer &buffer, const Window &window, const Tile &tile, vector<PixelSamples> &pixels,
+                    vector<uint8_t> &refine, int target, long long &samples, long long &refined) const {
+        long long samplesBefore = samples;
+        for (int imgY = tile.y0; imgY < tile.y1; imgY++) {
+            for (int imgX = tile.x0; imgX < tile.x1; imgX++) {
+                int index = window.index(imgX, imgY);
+                if (!refine[index]) continue;
+
+                PixelSamples &px = pixels[index];
+                if (!needsSamples(px, target)) {
+                    refine[index] = px.count < maxSamples && needsSamples(px, maxSamples);
+                    continue;
+                }
+
+                do {
+                    vec2 offset = sampleOffset(px.count, imgX, imgY);
+                    Ray ray = primaryRay(imgX - width / 2 + offset.x, height / 2 - imgY - offset.y);
+                    Hit hit = scene.closestHit(ray);
+                    px.add(shade(ray, hit), objectOf(hit));
+                    samples++;
+                } while (needsSamples(px, target));
+
+                buffer.set(imgX, imgY, px.mean());
+                refine[index] = px.count < maxSamples && needsSamples(px, maxSamples);
+                refined++;
+            }
+        }
+        RayCounters::count(&RayCounters::primaryRays, samples - samplesBefore);
+    }
+
+    /**
+     * Position of the n-th sample in the pixel, relative to its centre, within [-0.5, 0.5[.
+     * The first one is the centre, the others follow the (2, 3) Halton sequence,
+     * shifted by a per pixel offset so that neighbours don't share the same pattern.
+     *
+     * @param n
+     * @param px Pixel
+     * @param py
+     * @return
+     */
+    static vec2 sampleOffset(int n, int px, int py) {
+        if (n == 0) return vec2(0, 0);
+
+        uint32_t hash = (uint32_t) px * 73856093u ^ (uint32_t) py * 19349663u;
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+        float x = radicalInverse(n, 2) + (hash & 0xffff) / 65536.f;
+        float y = radicalInverse(n, 3) + (hash >> 16) / 65536.f;
+        return vec2(x - std::floor(x) - 0.5f, y - std::floor(y) - 0.5f);
+    }
+
+    static float radicalInverse(int n, int base) {
+        float inverse = 1.f / base, factor = inverse, result = 0;
+        while (n > 0) {
+            result += (n % base) * factor;
+            n /= base;
+            factor *= inverse;
+        }
+        return result;
+    }
+};
+
+
+#endif //RAYTRACER_RENDERER_H
@@ -0,0 +1,195 @@
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RAYTRACER_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAYTRACER_SIMD_SSE
+#endif
+
+#ifndef RAYTRACER_SIMD_H
+#define RAYTRACER_SIMD_H
+
+
+/**
+ * Thin wrappers over the widest float registers available at compile time:
+ * 8 lanes with AVX, 4 lanes with SSE2, and a plain 4 lanes array otherwise.
+ * Kernels written against vfloat/vmask compile to any of them.
+ */
+#if defined(RAYTRACER_SIMD_AVX)
+
+struct vmask {
+    __m256 v;
+
+    vmask() {}
+    vmask(__m256 v) : v(v) {}
+
+    int bits() const { return _mm256_movemask_ps(v); }
+    bool any() const { return bits() != 0; }
+
+    vmask operator&(const vmask &o) const { return _mm256_and_ps(v, o.v); }
+    vmask operator|(const vmask &o) const { return _mm256_or_ps(v, o.v); }
+};
+
+struct vfloat {
+    static const int WIDTH = 8;
+    __m256 v;
+
+    vfloat() {}
+    vfloat(__m256 v) : v(v) {}
+    vfloat(float f) : v(_mm256_set1_ps(f)) {}
+
+    static vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    vfloat operator+(const vfloat &o) const { return _mm256_add_ps(v, o.v); }
+    vfloat operator-(const vfloat &o) const { return _mm256_sub_ps(v, o.v); }
+    vfloat operator*(const vfloat &o) const { return _mm256_mul_ps(v, o.v); }
+    vfloat operator/(const vfloat &o) const { return _mm256_div_ps(v, o.v); }
+    vfloat operator-() const { return _mm256_sub_ps(_mm256_setzero_ps(), v); }
+
+    vmask operator<(const vfloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+    vmask operator>(const vfloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GT_OQ); }
+    vmask operator<=(const vfloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ); }
+    vmask operator>=(const vfloat &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+};
+
+inline vfloat vmin(const vfloat &a, const vfloat &b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat &a, const vfloat &b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat &a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline vmask maskFirst(int lanes) {
+    return _mm256_cmp_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps((float) lanes), _CMP_LT_OQ);
+}
+
+#elif defined(RAYTRACER_SIMD_SSE)
+
+struct vmask {
+    __m128 v;
+
+    vmask() {}
+    vmask(__m128 v) : v(v) {}
+
+    int bits() const { return _mm_movemask_ps(v); }
+    bool any() const { return bits() != 0; }
+
+    vmask operator&(const vmask &o) const { return _mm_and_ps(v, o.v); }
+    vmask operator|(const vmask &o) const { return _mm_or_ps(v, o.v); }
+};
+
+struct vfloat {
+    static const int WIDTH = 4;
+    __m128 v;
+
+    vfloat() {}
+    vfloat(__m128 v) : v(v) {}
+    vfloat(float f) : v(_mm_set1_ps(f)) {}
+
+    static vfloat load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+
+    vfloat operator+(const vfloat &o) const { return _mm_add_ps(v, o.v); }
+    vfloat operator-(const vfloat &o) const { return _mm_sub_ps(v, o.v); }
+    vfloat operator*(const vfloat &o) const { return _mm_mul_ps(v, o.v); }
+    vfloat operator/(const vfloat &o) const { return _mm_div_ps(v, o.v); }
+    vfloat operator-() const { return _mm_sub_ps(_mm_setzero_ps(), v); }
+
+    vmask operator<(const vfloat &o) const { return _mm_cmplt_ps(v, o.v); }
+    vmask operator>(const vfloat &o) const { return _mm_cmpgt_ps(v, o.v); }
+    vmask operator<=(const vfloat &o) const { return _mm_cmple_ps(v, o.v); }
+    vmask operator>=(const vfloat &o) const { return _mm_cmpge_ps(v, o.v); }
+};
+
+inline vfloat vmin(const vfloat &a, const vfloat &b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat &a, const vfloat &b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat &a) { return _mm_sqrt_ps(a.v); }
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) {
+    return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+inline vmask maskFirst(int lanes) {
+    return _mm_cmplt_ps(_mm_setr_ps(0, 1, 2, 3), _mm_set1_ps((float) lanes));
+}
+
+#else
+
+struct vmask {
+    bool v[4];
+
+    int bits() const { return v[0] | v[1] << 1 | v[2] << 2 | v[3] << 3; }
+    bool any() const { return bits() != 0; }
+
+    vmask operator&(const vmask &o) const { return {{v[0] && o.v[0], v[1] && o.v[1], v[2] && o.v[2], v[3] && o.v[3]}}; }
+    vmask operator|(const vmask &o) const { return {{v[0] || o.v[0], v[1] || o.v[1], v[2] || o.v[2], v[3] || o.v[3]}}; }
+};
+
+struct vfloat {
+    static const int WIDTH = 4;
+    float v[4];
+
+    vfloat() {}
+    vfloat(float f) : v{f, f, f, f} {}
+
+    static vfloat load(const float *p) {
+        vfloat r;
+        for (int i = 0; i < 4; i++) r.v[i] = p[i];
+        return r;
+    }
+    void store(float *p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+#define RAYTRACER_LANEWISE(op, type) \
+    type operator op(const vfloat &o) const { type r; for (int i = 0; i < 4; i++) r.v[i] = v[i] op o.v[i]; return r; }
+    RAYTRACER_LANEWISE(+, vfloat)
+    RAYTRACER_LANEWISE(-, vfloat)
+    RAYTRACER_LANEWISE(*, vfloat)
+    RAYTRACER_LANEWISE(/, vfloat)
+    RAYTRACER_LANEWISE(<, vmask)
+    RAYTRACER_LANEWISE(>, vmask)
+    RAYTRACER_LANEWISE(<=, vmask)
+    RAYTRACER_LANEWISE(>=, vmask)
+#undef RAYTRACER_LANEWISE
+
+    vfloat operator-() const { return vfloat(0.f) - *this; }
+};
+
+inline vfloat vmin(const vfloat &a, const vfloat &b) {
+    vfloat r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+inline vfloat vmax(const vfloat &a, const vfloat &b) {
+    vfloat r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+inline vfloat vsqrt(const vfloat &a) {
+    vfloat r;
+    for (int i = 0; i < 4; i++) r.v[i] = std::sqrt(a.v[i]);
+    return r;
+}
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) {
+    vfloat r;
+    for (int i = 0; i < 4; i++) r.v[i] = m.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+inline vmask maskFirst(int lanes) { return {{0 < lanes, 1 < lanes, 2 < lanes, 3 < lanes}}; }
+
+#endif
+
+
+/**
+ * Name of the instruction set the packets were compiled for
+ * @return
+ */
+inline const char *simdName() {
+#if defined(RAYTRACER_SIMD_AVX)
+    return "AVX, 8 lanes";
+#elif defined(RAYTRACER_SIMD_SSE)
+    return "SSE2, 4 lanes";
+#else
+    return "scalar fallback, 4 lanes";
+#endif
+}
+
+
+#endif //RAYTRACER_SIMD_H
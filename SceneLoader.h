@@ -0,0 +1,677 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include "glm.hpp"
+#include "OBJParser.h"
+#include "MeshCache.h"
+#include "NeededMath.h"
+#include "geometry.h"
+#include "Options.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace glm;
+
+#ifndef RAYTRACER_SCENELOADER_H
+#define RAYTRACER_SCENELOADER_H
+
+
+// Meshes of the OBJ files already loaded, by path, shared by all the scenes of a batch
+typedef map<string, Mesh> OBJCache;
+
+/**
+ * Word of a scene file, pointing into the file, with where it starts for the error messages
+ */
+struct SceneToken {
+    const char *begin = nullptr;
+    size_t length = 0;
+    int line = 1, column = 1;
+
+    bool is(const char *word) const {
+        return strlen(word) == length && memcmp(begin, word, length) == 0;
+    }
+
+    // Fields end with ':', anything else starts a block
+    bool isField() const { return length > 0 && begin[length - 1] == ':'; }
+
+    string str() const { return string(begin, length); }
+};
+
+
+/**
+ * Reads a scene file in one pass over its bytes, word by word, words being separated by blanks and line breaks.
+ * '#' comments out the rest of a line.
+ *
+ * The first problem met is kept, with its line and column, and ends the reading: every call after it returns false.
+ */
+class SceneReader {
+    string path;
+    const char *p, *end;
+    const char *lineStart;
+    int line = 1;
+
+    SceneToken ahead;               // Read by nextField, and not a field
+    bool hasAhead = false;
+    vector<SceneToken> blockFields; // Fields given so far by the current block
+    string problem;
+
+public:
+    SceneReader(const string &path, const char *data, size_t size)
+            : path(path), p(data), end(data + size), lineStart(data) {}
+
+    bool failed() const { return !problem.empty(); }
+
+    // "file:line:column: what went wrong"
+    const string &error() const { return problem; }
+
+    /**
+     * Keep the first problem met
+     * @param at Where it is
+     * @param what
+     * @return false, for the callers to return it
+     */
+    bool fail(const SceneToken &at, const string &what) {
+        if (!failed())
+            problem = path + ":" + to_string(at.line) + ":" + to_string(at.column) + ": " + what;
+        return false;
+    }
+
+    /**
+     * Next word, whatever it is
+     * @param token
+     * @return false at the end of the file, or after a problem
+     */
+    bool next(SceneToken &token) {
+        if (failed()) return false;
+        if (hasAhead) {
+            token = ahead;
+            hasAhead = false;
+            return true;
+        }
+
+        // Blanks, line breaks and comments
+        while (p < end) {
+            char c = *p;
+            if (c == '\n') {
+                line++;
+                lineStart = ++p;
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                p++;
+            } else if (c == '#') {
+                const char *eol = (const char *) memchr(p, '\n', end - p);
+                p = eol ? eol : end;
+            } else {
+                break;
+            }
+        }
+        if (p == end) return false;
+
+        token.begin = p;
+        token.line = line;
+        token.column = (int) (p - lineStart) + 1;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+        token.length = p - token.begin;
+        return true;
+    }
+
+    /**
+     * Start reading the fields of a block
+     */
+    void beginBlock() {
+        blockFields.clear();
+    }
+
+    /**
+     * Next field of the current block if the next word is one, otherwise the word is left for the next block.
+     * Fields come in any order, each one at most once except "key:".
+     *
+     * @param field
+     * @return false if the block has no more fields
+     */
+    bool nextField(SceneToken &field) {
+        if (!next(field)) return false;
+        if (!field.isField()) {
+            ahead = field;
+            hasAhead = true;
+            return false;
+        }
+
+        for (const SceneToken &given : blockFields) {
+            if (given.length == field.length && memcmp(given.begin, field.begin, field.length) == 0 && !field.is("key:"))
+                return fail(field, field.str() + " given twice, first on line " + to_string(given.line));
+        }
+        blockFields.push_back(field);
+        return true;
+    }
+
+    /**
+     * Check the current block gave a field
+     * @param block Where to report it missing
+     * @param name
+     * @return
+     */
+    bool require(const SceneToken &block, const char *name) {
+        for (const SceneToken &given : blockFields) {
+            if (given.is(name)) return true;
+        }
+        return fail(block, block.str() + " without " + name);
+    }
+
+    /**
+     * Report a field the block doesn't know
+     * @param block
+     * @param field
+     * @return false
+     */
+    bool unknown(const SceneToken &block, const SceneToken &field) {
+        return fail(field, "Unknown field " + field.str() + " in a " + block.str());
+    }
+
+    /**
+     * Read a number of the value of a field
+     * @param field
+     * @param value
+     * @return
+     */
+    bool readDouble(const SceneToken &field, double &value) {
+        SceneToken token;
+        if (!readValue(field, token)) return false;
+
+        const char *s = token.begin;
+        if (!objparse::parseDouble(s, token.begin + token.length, value) || s != token.begin + token.length)
+            return fail(token, "Invalid number " + token.str() + " in " + field.str());
+        return true;
+    }
+
+    bool readFloat(const SceneToken &field, float &value) {
+        double number;
+        if (!readDouble(field, number)) return false;
+        value = (float) number;
+        return true;
+    }
+
+    bool readInt(const SceneToken &field, int &value) {
+        SceneToken token;
+        if (!readValue(field, token)) return false;
+
+        const char *s = token.begin;
+        if (!objparse::parseInt(s, token.begin + token.length, value) || s != token.begin + token.length)
+            return fail(token, "Invalid integer " + token.str() + " in " + field.str());
+        return true;
+    }
+
+    bool readVec3(const SceneToken &field, vec3 &value) {
+        return readFloat(field, value.x) && readFloat(field, value.y) && readFloat(field, value.z);
+    }
+
+    bool readWord(const SceneToken &field, string &value) {
+        SceneToken token;
+        if (!readValue(field, token)) return false;
+        value = token.str();
+        return true;
+    }
+
+private:
+    // Next word, as long as the value doesn't stop short before the end of the file or the next field
+    bool readValue(const SceneToken &field, SceneToken &token) {
+        if (!next(token))
+            return fail(field, "Missing value of " + field.str());
+        if (token.isField())
+            return fail(token, "Missing value of " + field.str() + " before " + token.str());
+        return true;
+    }
+};
+
+
+// Signatures
+bool loadMesh(const string &path, Mesh &mesh, const Options &options, PhaseTimes &times);
+
+int sceneMesh(const string &path, Scene &scene, map<string, int> &sceneMeshes, OBJCache &objCache,
+              const Options &options, PhaseTimes &times);
+
+int sceneTexture(const string &path, Scene &scene, const Options &options, PhaseTimes &times);
+
+bool readMaterialField(SceneReader &reader, const SceneToken &field, Material &mat);
+
+bool readKey(SceneReader &reader, const SceneToken &field, Track &track);
+
+bool isNumber(const SceneToken &token);
+
+
+/**
+ * Parse a scene file and create the objects of the scene, in a single pass over the file mapped in memory.
+ *
+ * The file is a list of blocks: "camera", "sphere", "plane", "light", "mesh" and "animation", each one followed by
+ * its fields in any order, "name: values". A count of objects may come first, it is ignored.
+ * Fields left out take their default: the origin for positions, a black material with a shininess of 1, white lights,
+ * a 4:3 camera looking down -z. The camera needs "fov:" and "f:" (or "res:"), spheres "rad:", planes "nor:" and
+ * meshes "file:".
+ * Unknown blocks and fields, fields given twice, missing or invalid values stop the loading,
+ * with the line and column of the problem.
+ *
+ * The camera looks at "look: <x> <y> <z>" when given, "up:" telling which way is up, (0, 1, 0) by default,
+ * and "res: <width> <height>" gives the resolution, the vertical field of view staying the same whatever it is.
+ *
+ * Lights are points, unless given a shape: "rect: <side 1> <side 2>", a rectangle centred on "pos:" given by
+ * its two sides as vectors, or "rad:", a sphere. Their soft shadows take up to "samples: <n>" shadow rays, 16 by default.
+ *
+ * Each mesh block is an instance of its OBJ file, placed by "pos:", "rot:" (degrees about x, y then z) and "scale:",
+ * the triangles of a file being loaded once however many instances use it.
+ * Their "difmap:" and "spemap:" images multiply the diffuse and specular colors over the texture coordinates of the file.
+ * Besides their fields, the camera, objects, lights and meshes take keys: "key: <frame> <x> <y> <z>",
+ * their position at a frame. An "animation" with "frames: <n>" gives the length of the sequence,
+ * keys past it being left out, otherwise it ends with the last key.
+ *
+ * @param path
+ * @param scene
+ * @param objCache OBJ files already loaded, reused instead of reading them again
+ * @param options
+ * @param times Gets the time spent loading the OBJ files
+ * @param bytes Gets the size of the scene file
+ * @return false if the file couldn't be read or isn't a valid scene, the scene is then incomplete
+ */
+bool loadScene(const string &path, Scene &scene, OBJCache &objCache, const Options &options, PhaseTimes &times,
+               size_t &bytes) {
+    MappedFile file;
+    if (!file.open(path.c_str())) {
+        cerr << "Unable to open file " << path << endl;
+        return false;
+    }
+    bytes = file.size;
+
+    SceneReader reader(path, file.data, file.size);
+    Animation &animation = scene.animation;
+    map<string, int> sceneMeshes;     // Index in scene.meshes of each OBJ file already used by the scene
+    bool hasCamera = false, first = true;
+    SceneToken block, field;
+
+    // Until there is no more blocks
+    while (reader.next(block)) {
+        reader.beginBlock();
+
+        if (block.is("camera")) {
+            if (hasCamera) {
+                reader.fail(block, "Second camera");
+                break;
+            }
+            hasCamera = true;
+            Camera &cam = scene.cam;
+            cam = Camera(vec3());
+            cam.aspectRatio = 4 / 3.f;
+
+            while (reader.nextField(field)) {
+                if (field.is("pos:")) {
+                    reader.readVec3(field, cam.position);
+                } else if (field.is("fov:")) {
+                    double degrees;
+                    if (reader.readDouble(field, degrees)) {
+                        if (degrees <= 0 || degrees >= 180)
+                            reader.fail(field, "Invalid field of view");
+                        cam.fov = degrees * (M_PI / 180);
+                    }
+                } else if (field.is("f:")) {
+                    if (reader.readFloat(field, cam.focalLength) && cam.focalLength <= 0)
+                        reader.fail(field, "Invalid focal length");
+                } else if (field.is("a:")) {
+                    if (reader.readFloat(field, cam.aspectRatio) && cam.aspectRatio <= 0)
+                        reader.fail(field, "Invalid aspect ratio");
+                } else if (field.is("look:")) {
+                    cam.aimed = reader.readVec3(field, cam.target);
+                } else if (field.is("up:")) {
+                    if (reader.readVec3(field, cam.up) && cam.up == vec3())
+                        reader.fail(field, "Null up direction");
+                } else if (field.is("res:")) {
+                    if (reader.readInt(field, cam.width) && reader.readInt(field, cam.height) &&
+                        (cam.width <= 0 || cam.height <= 0))
+                        reader.fail(field, "Invalid resolution");
+                } else if (field.is("key:")) {
+                    readKey(reader, field, animation.camera);
+                } else {
+                    reader.unknown(block, field);
+                }
+            }
+            // The resolution comes from the focal length unless given
+            reader.require(block, "fov:") && (cam.width > 0 || reader.require(block, "f:"));
+
+        } else if (block.is("sphere")) {
+            Sphere *sphere = scene.create<Sphere>(vec3(0,0,0), 0);
+            Material mat;
+            Track track;
+
+            while (reader.nextField(field)) {
+                if (field.is("pos:")) {
+                    reader.readVec3(field, sphere->position);
+                } else if (field.is("rad:")) {
+                    if (reader.readDouble(field, sphere->radius) && sphere->radius <= 0)
+                        reader.fail(field, "Invalid radius");
+                } else if (field.is("key:")) {
+                    readKey(reader, field, track);
+                } else if (!readMaterialField(reader, field, mat)) {
+                    reader.unknown(block, field);
+                }
+            }
+            reader.require(block, "rad:");
+            sphere->material = mat;
+            if (!track.empty())
+                animation.objects.emplace_back(scene.objs.size() - 1, std::move(track));
+
+        } else if (block.is("plane")) {
+            Plane *plane = scene.create<Plane>();
+            plane->position = vec3();
+            Material mat;
+            Track track;
+
+            while (reader.nextField(field)) {
+                if (field.is("pos:")) {
+                    reader.readVec3(field, plane->position);
+                } else if (field.is("nor:")) {
+                    reader.readVec3(field, plane->normal);
+                } else if (field.is("key:")) {
+                    readKey(reader, field, track);
+                } else if (!readMaterialField(reader, field, mat)) {
+                    reader.unknown(block, field);
+                }
+            }
+            reader.require(block, "nor:");
+            plane->material = mat;
+            if (!track.empty())
+                animation.objects.emplace_back(scene.objs.size() - 1, std::move(track));
+
+        } else if (block.is("light")) {
+            Light *light = scene.create<Light>();
+            light->position = vec3();
+            light->diffuseColor = light->specularColor = vec3(1, 1, 1);
+            Track track;
+
+            while (reader.nextField(field)) {
+                if (field.is("pos:")) {
+                    reader.readVec3(field, light->position);
+                } else if (field.is("dif:")) {
+                    reader.readVec3(field, light->diffuseColor);
+                } else if (field.is("spe:")) {
+                    reader.readVec3(field, light->specularColor);
+                } else if (field.is("rect:")) {
+                    if (light->shape == Light::SPHERE)
+                        reader.fail(field, "A light is either a rectangle or a sphere");
+                    else if (reader.readVec3(field, light->edge1) && reader.readVec3(field, light->edge2))
+                        light->shape = Light::RECTANGLE;
+                } else if (field.is("rad:")) {
+                    if (light->shape == Light::RECTANGLE)
+                        reader.fail(field, "A light is either a rectangle or a sphere");
+                    else if (reader.readFloat(field, light->radius) && light->radius <= 0)
+                        reader.fail(field, "Invalid radius");
+                    light->shape = light->radius > 0 ? Light::SPHERE : light->shape;
+                } else if (field.is("samples:")) {
+                    if (reader.readInt(field, light->samples) && light->samples <= 0)
+                        reader.fail(field, "Invalid sample count");
+                } else if (field.is("key:")) {
+                    readKey(reader, field, track);
+                } else {
+                    reader.unknown(block, field);
+                }
+            }
+            if (!track.empty())
+                animation.lights.emplace_back(scene.lights.size() - 1, std::move(track));
+
+        } else if (block.is("mesh")) {
+            MeshInstance instance(-1, 0);
+            Material mat;
+            Track track;
+            string name;
+            SceneToken file;
+            vec3 position = vec3(), rotation = vec3(), scale = vec3(1, 1, 1);
+
+            while (reader.nextField(field)) {
+                if (field.is("file:")) {
+                    file = field;
+                    reader.readWord(field, name);
+                } else if (field.is("pos:")) {
+                    reader.readVec3(field, position);
+                } else if (field.is("rot:")) {
+                    reader.readVec3(field, rotation);
+                } else if (field.is("scale:")) {
+                    // Mirrored is fine, flat is not: the instance has to be inverted
+                    if (reader.readVec3(field, scale) && (scale.x == 0 || scale.y == 0 || scale.z == 0))
+                        reader.fail(field, "Invalid scale");
+                } else if (field.is("difmap:") || field.is("spemap:")) {
+                    string image;
+                    if (reader.readWord(field, image)) {
+                        int texture = sceneTexture("scenes/" + image, scene, options, times);
+                        if (texture < 0)
+                            reader.fail(field, "Unable to read the texture " + image);
+                        (field.is("difmap:") ? mat.diffuseMap : mat.specularMap) = texture;
+                    }
+                } else if (field.is("key:")) {
+                    readKey(reader, field, track);
+                } else if (!readMaterialField(reader, field, mat)) {
+                    reader.unknown(block, field);
+                }
+            }
+            if (!reader.require(block, "file:"))
+                break;
+
+            // Load OBJ and create triangles for the mesh
+            instance.mesh = sceneMesh("scenes/" + name, scene, sceneMeshes, objCache, options, times);
+            if (instance.mesh < 0) {
+                reader.fail(file, "Unable to load the mesh " + name);
+                break;
+            }
+            if (mat.textured() && !scene.meshes[instance.mesh].hasUVs())
+                cerr << name << " has no texture coordinates, its texture maps are ignored" << endl;
+            if (!track.empty())
+                animation.instances.emplace_back(scene.instances.size(), std::move(track));
+
+            // The whole instance shares one material
+            instance.setTransform(position, rotationMatrix(rotation) * mat3(vec3(scale.x, 0, 0), vec3(0, scale.y, 0),
+                                                                            vec3(0, 0, scale.z)));
+            instance.material = scene.materials.size();
+            scene.materials.push_back(mat);
+            scene.instances.push_back(instance);
+
+        } else if (block.is("animation")) {
+            while (reader.nextField(field)) {
+                if (field.is("frames:")) {
+                    if (reader.readInt(field, animation.frames) && animation.frames <= 0)
+                        reader.fail(field, "Invalid frame count");
+                } else {
+                    reader.unknown(block, field);
+                }
+            }
+
+        } else if (block.isField()) {
+            reader.fail(block, "Field " + block.str() + " outside of a block");
+        } else if (isNumber(block)) {
+            if (!first)
+                reader.fail(block, "Extra value " + block.str());
+        } else {
+            reader.fail(block, "Unknown block " + block.str());
+        }
+        first = false;
+    }
+
+    if (!hasCamera)
+        reader.fail(SceneToken(), "No camera");
+    if (reader.failed()) {
+        cerr << reader.error() << endl;
+        return false;
+    }
+
+    animation.coverKeys();
+    return true;
+}
+
+/**
+ * Mesh of an OBJ file in the scene, added the first time an instance uses it
+ * @param path
+ * @param scene
+ * @param sceneMeshes Meshes of the scene, by path
+ * @param objCache
+ * @param options
+ * @param times
+ * @return Index in scene.meshes, -1 if the file couldn't be read
+ */
+int sceneMesh(const string &path, Scene &scene, map<string, int> &sceneMeshes, OBJCache &objCache,
+              const Options &options, PhaseTimes &times) {
+    auto used = sceneMeshes.find(path);
+    if (used != sceneMeshes.end())
+        return used->second;
+
+    // Load the mesh, unless an earlier scene already did
+    auto cached = objCache.find(path);
+    if (cached == objCache.end()) {
+        cached = objCache.emplace(path, Mesh()).first;
+        if (!loadMesh(path, cached->second, options, times)) {
+            // Not kept for the next scenes, which try the file again
+            objCache.erase(cached);
+            return -1;
+        }
+    }
+
+    // Buffers read from the cache file are shared with the cached mesh
+    sceneMeshes[path] = scene.meshes.size();
+    scene.meshes.push_back(cached->second);
+    return scene.meshes.size() - 1;
+}
+
+/**
+ * Load the triangles of an OBJ file with their BVH.
+ * Uses the binary cache next to the file when it is up to date, otherwise parses the file and writes the cache.
+ *
+ * @param path
+ * @param mesh
+ * @param options
+ * @param times Gets the time of each step: "mesh cache read", or "obj parse", "triangles", "mesh bvh" and "mesh cache write"
+ * @return false if the file couldn't be read, the mesh is left empty
+ */
+bool loadMesh(const string &path, Mesh &mesh, const Options &options, PhaseTimes &times) {
+    auto start = chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+
+    if (options.meshCache && times.time("mesh cache read", [&]() { return readMeshCache(path, mesh); })) {
+        cout << path << ": " << mesh.size() << " triangles read from " << meshCachePath(path)
+             << " in " << elapsed() << " ms" << endl;
+        return true;
+    }
+
+    OBJData obj;
+    int threads = options.threads > 0 ? options.threads : threadCount();
+    if (!times.time("obj parse", [&]() { return loadOBJFast(path.c_str(), obj, threads); }))
+        return false;
+
+    // Build triangles out of the indexed vertices
+    times.time("triangles", [&]() {
+        mesh.reserve(obj.triangleCount());
+        for (size_t t = 0; t < obj.triangleCount(); t++) {
+            mesh.addTriangle(obj.corner(t, 0), obj.corner(t, 1), obj.corner(t, 2));
+        }
+
+        // Corners without texture coordinates in a file that has some get (0, 0)
+        if (!obj.uvs.empty()) {
+            auto uv = [&](size_t index) { return obj.uvIndices[index] < 0 ? vec2(0, 0) : obj.uvs[obj.uvIndices[index]]; };
+            for (size_t t = 0; t < obj.triangleCount(); t++)
+                mesh.addUVs(uv(t * 3), uv(t * 3 + 1), uv(t * 3 + 2));
+        }
+
+        // Vertex normals make the mesh smooth, corners without one get the normal of their face
+        if (!obj.normals.empty()) {
+            for (size_t t = 0; t < obj.triangleCount(); t++) {
+                vec3 face = mesh.getNormal(t);
+                auto normal = [&](size_t index) { return obj.normalIndices[index] < 0 ? face : obj.normals[obj.normalIndices[index]]; };
+                mesh.addNormals(normal(t * 3), normal(t * 3 + 1), normal(t * 3 + 2));
+            }
+        }
+    });
+    times.time("mesh bvh", [&]() { mesh.buildBVH(); });
+    cout << path << ": " << mesh.size() << " triangles parsed in " << elapsed() << " ms" << endl;
+
+    if (options.meshCache && !times.time("mesh cache write", [&]() { return writeMeshCache(path, mesh); }))
+        cerr << "Unable to write the mesh cache " << meshCachePath(path) << endl;
+    return true;
+}
+
+/**
+ * Index of a texture in the cache of the scene, creating the cache for the first one
+ * @param path
+ * @param scene
+ * @param options
+ * @param times Gets the time spent on the texture files, "texture tiles"
+ * @return -1 if the image can't be read
+ */
+int sceneTexture(const string &path, Scene &scene, const Options &options, PhaseTimes &times) {
+    if (!scene.textures)
+        scene.textures = make_shared<TextureCache>((size_t) options.textureMemory << 20);
+    return times.time("texture tiles", [&]() { return scene.textures->open(path); });
+}
+
+/**
+ * Read the value of a material field
+ * @param reader
+ * @param field
+ * @param mat
+ * @return false if the field isn't one of a material
+ */
+bool readMaterialField(SceneReader &reader, const SceneToken &field, Material &mat) {
+    if (field.is("amb:")) {
+        reader.readVec3(field, mat.ambient);
+    } else if (field.is("dif:")) {
+        reader.readVec3(field, mat.diffuse);
+    } else if (field.is("spe:")) {
+        reader.readVec3(field, mat.specular);
+    } else if (field.is("shi:")) {
+        reader.readFloat(field, mat.shininess);
+    } else if (field.is("ref:")) {
+        if (reader.readFloat(field, mat.reflectivity)) {
+            if (mat.reflectivity < 0 || mat.reflectivity > 1)
+                reader.fail(field, "Invalid reflectivity");
+            else if (mat.reflectivity + mat.transmission > 1)
+                reader.fail(field, "Reflectivity and transmission above 1");
+        }
+    } else if (field.is("tra:")) {
+        if (reader.readFloat(field, mat.transmission)) {
+            if (mat.transmission < 0 || mat.transmission > 1)
+                reader.fail(field, "Invalid transmission");
+            else if (mat.reflectivity + mat.transmission > 1)
+                reader.fail(field, "Reflectivity and transmission above 1");
+        }
+    } else if (field.is("ior:")) {
+        if (reader.readFloat(field, mat.ior) && mat.ior <= 0)
+            reader.fail(field, "Invalid index of refraction");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a key: its frame, then the position
+ * @param reader
+ * @param field
+ * @param track
+ * @return false if it isn't valid
+ */
+bool readKey(SceneReader &reader, const SceneToken &field, Track &track) {
+    float frame;
+    vec3 position;
+    if (!reader.readFloat(field, frame) || !reader.readVec3(field, position))
+        return false;
+    track.add(frame, position);
+    return true;
+}
+
+/**
+ * Whether a word is a number: the count of objects the older scene files start with, or a value too many
+ * @param token
+ * @return
+ */
+bool isNumber(const SceneToken &token) {
+    double number;
+    const char *s = token.begin;
+    return objparse::parseDouble(s, token.begin + token.length, number) && s == token.begin + token.length;
+}
+
+
+#endif //RAYTRACER_SCENELOADER_H
@@ -0,0 +1,325 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef RAYTRACER_STATS_H
+#define RAYTRACER_STATS_H
+
+
+/**
+ * Work done by the renderer, counted by each thread on its own and merged at the end of a render.
+ * Counting is off unless enabled() is set: the queries count in local variables, and only publish them when it is on.
+ */
+struct RayCounters {
+    long long primaryRays = 0;
+    long long secondaryRays = 0;    // Reflections and refractions
+    long long shadowRays = 0;
+
+    long long objectTests = 0;      // Ray against sphere or plane
+    long long triangleTests = 0;
+    long long packetTests = 0;      // Packet against a primitive, all lanes at once
+
+    long long occluderCacheHits = 0;    // Shadow rays stopped by the last occluder of their light
+    long long lightsSkipped = 0;        // Lights too faint to need a shadow ray
+    long long occluded = 0;             // Shadow rays finding an occluder
+    long long shadowSamplesSkipped = 0; // Samples of area lights going without a shadow ray, the first ones agreeing
+
+    long long textureSamples = 0;
+    long long textureTilesRead = 0;     // Texture tiles read from their file, not being in the cache
+    long long textureTilesEvicted = 0;  // To make room for them
+
+    long long rays() const { return primaryRays + secondaryRays + shadowRays; }
+    long long tests() const { return objectTests + triangleTests; }
+
+    void add(const RayCounters &o) {
+        primaryRays += o.primaryRays;
+        secondaryRays += o.secondaryRays;
+        shadowRays += o.shadowRays;
+        objectTests += o.objectTests;
+        triangleTests += o.triangleTests;
+        packetTests += o.packetTests;
+        occluderCacheHits += o.occluderCacheHits;
+        lightsSkipped += o.lightsSkipped;
+        occluded += o.occluded;
+        shadowSamplesSkipped += o.shadowSamplesSkipped;
+        textureSamples += o.textureSamples;
+        textureTilesRead += o.textureTilesRead;
+        textureTilesEvicted += o.textureTilesEvicted;
+    }
+
+    static bool &enabled() {
+        static bool on = false;
+        return on;
+    }
+
+    /**
+     * Counters of the calling thread
+     * @return
+     */
+    static RayCounters &local() {
+        static thread_local RayCounters counters;
+        return counters;
+    }
+
+    /**
+     * Add to a counter of the calling thread, if counting
+     * @param counter
+     * @param n
+     */
+    static void count(long long RayCounters::*counter, long long n = 1) {
+        if (enabled()) local().*counter += n;
+    }
+};
+
+
+/**
+ * Cache misses of this process and of the threads it starts while counting, from the hardware counters.
+ * Only on Linux, when the kernel lets a user read them (perf_event_paranoid) and the machine has them:
+ * virtual machines often don't.
+ */
+class CacheMisses {
+    int fd = -1;
+
+public:
+    CacheMisses() {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.inherit = 1;           // The render threads, started later
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    CacheMisses(const CacheMisses &) = delete;
+    CacheMisses &operator=(const CacheMisses &) = delete;
+
+    ~CacheMisses() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool available() const { return fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    /**
+     * @return Misses since start(), once the threads started meanwhile have exited. -1 if unavailable
+     */
+    long long stop() {
+#ifdef __linux__
+        long long count;
+        if (fd >= 0 && ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) == 0 && read(fd, &count, sizeof(count)) == sizeof(count))
+            return count;
+#endif
+        return -1;
+    }
+};
+
+
+/**
+ * Wall time of the phases of a job, in the order they first ran.
+ * A phase running several times (one OBJ file after another) adds up.
+ */
+class PhaseTimes {
+    typedef chrono::steady_clock Clock;
+
+public:
+    vector<pair<string, double>> phases;   // Seconds
+
+    void add(const string &phase, double seconds) {
+        for (auto &p : phases) {
+            if (p.first == phase) {
+                p.second += seconds;
+                return;
+            }
+        }
+        phases.emplace_back(phase, seconds);
+    }
+
+    double total() const {
+        double seconds = 0;
+        for (const auto &p : phases) seconds += p.second;
+        return seconds;
+    }
+
+    double get(const string &phase) const {
+        for (const auto &p : phases) {
+            if (p.first == phase) return p.second;
+        }
+        return 0;
+    }
+
+    /**
+     * Run the work, and add its duration to the phase
+     * @param phase
+     * @param work
+     * @return What the work returned
+     */
+    template<typename Work>
+    auto time(const string &phase, Work &&work) -> decltype(work()) {
+        Stopwatch stopwatch(*this, phase);
+        return work();
+    }
+
+    /**
+     * Adds the time until it goes out of scope to a phase
+     */
+    struct Stopwatch {
+        PhaseTimes &times;
+        string phase;
+        Clock::time_point start = Clock::now();
+
+        Stopwatch(PhaseTimes &times, const string &phase) : times(times), phase(phase) {}
+        ~Stopwatch() { times.add(phase, chrono::duration<double>(Clock::now() - start).count()); }
+    };
+};
+
+
+/**
+ * Timings and counters of the render of one scene, printed for people or as JSON
+ */
+struct SceneReport {
+    string scene;
+    int width = 0, height = 0;
+    int threads = 1;
+    string precision = "double";    // Of the sphere and plane intersections
+    PhaseTimes times;
+    RayCounters counters;
+    size_t sceneBytes = 0;          // Of the scene file, 0 for a generated scene
+    string pixelOrder = "z";        // Of the pixels in a tile: "z" or "rows"
+    long long cacheMisses = -1;     // During the render, -1 if the hardware counters can't be read
+
+    /**
+     * Megabytes of scene file parsed per second, the OBJ files left out
+     * @return
+     */
+    double sceneMBPerSecond() const {
+        double parse = times.get("scene file");
+        return parse > 0 ? sceneBytes / parse / 1e6 : 0;
+    }
+
+    /**
+     * Rays traced per second of render
+     * @return
+     */
+    double raysPerSecond() const {
+        double render = times.get("render");
+        return render > 0 ? counters.rays() / render : 0;
+    }
+
+    /**
+     * Average cost of an intersection test, taking every thread as busy for the whole render
+     * @return
+     */
+    double nsPerTest() const {
+        return counters.tests() > 0 ? times.get("render") * threads * 1e9 / counters.tests() : 0;
+    }
+
+    string toJSON() const {
+        ostringstream out;
+        out << "{\"scene\": " << quote(scene) << ", \"width\": " << width << ", \"height\": " << height
+            << ", \"threads\": " << threads << ", \"precision\": " << quote(precision)
+            << ", \"pixelOrder\": " << quote(pixelOrder) << ", \"phases\": {";
+        for (size_t p = 0; p < times.phases.size(); p++)
+            out << (p ? ", " : "") << quote(times.phases[p].first) << ": " << times.phases[p].second;
+        out << "}, \"counters\": {"
+            << "\"primaryRays\": " << counters.primaryRays
+            << ", \"secondaryRays\": " << counters.secondaryRays
+            << ", \"shadowRays\": " << counters.shadowRays
+            << ", \"objectTests\": " << counters.objectTests
+            << ", \"triangleTests\": " << counters.triangleTests
+            << ", \"packetTests\": " << counters.packetTests
+            << ", \"occluderCacheHits\": " << counters.occluderCacheHits
+            << ", \"lightsSkipped\": " << counters.lightsSkipped
+            << ", \"occluded\": " << counters.occluded
+            << ", \"shadowSamplesSkipped\": " << counters.shadowSamplesSkipped
+            << ", \"textureSamples\": " << counters.textureSamples
+            << ", \"textureTilesRead\": " << counters.textureTilesRead
+            << ", \"textureTilesEvicted\": " << counters.textureTilesEvicted
+            << "}, \"sceneBytes\": " << sceneBytes
+            << ", \"sceneMBPerSecond\": " << sceneMBPerSecond()
+            << ", \"raysPerSecond\": " << raysPerSecond()
+            << ", \"nsPerTest\": " << nsPerTest() << ", \"cacheMisses\": " << cacheMisses << "}";
+        return out.str();
+    }
+
+    void print(ostream &out) const {
+        out << "Timings of " << scene << " (" << precision << " precision, " << (pixelOrder == "z" ? "Z order" : "row order")
+            << "):" << endl;
+        for (const auto &phase : times.phases)
+            out << "  " << phase.first << ": " << phase.second * 1000 << " ms" << endl;
+        if (sceneBytes > 0)
+            out << "  parsed " << sceneBytes << " bytes of scene file (" << sceneMBPerSecond() << " MB/s)" << endl;
+        out << "  rays: " << counters.primaryRays << " primary, " << counters.secondaryRays << " secondary, "
+            << counters.shadowRays << " shadow (" << raysPerSecond() / 1e6 << " M/s)" << endl
+            << "  intersection tests: " << counters.objectTests << " objects, " << counters.triangleTests
+            << " triangles (" << nsPerTest() << " ns each), " << counters.packetTests << " by packets" << endl
+            << "  shadows: " << counters.occluded << " occluded, " << counters.occluderCacheHits
+            << " by the last occluder, " << counters.lightsSkipped << " lights skipped, "
+            << counters.shadowSamplesSkipped << " area light samples skipped" << endl;
+        if (counters.textureSamples > 0)
+            out << "  textures: " << counters.textureSamples << " samples, " << counters.textureTilesRead << " tiles read, "
+                << counters.textureTilesEvicted << " evicted" << endl;
+        if (cacheMisses >= 0)
+            out << "  cache misses: " << cacheMisses << " (" << (counters.rays() > 0 ? (double) cacheMisses / counters.rays() : 0)
+                << " per ray)" << endl;
+    }
+
+    /**
+     * Write reports as a JSON array
+     * @param path
+     * @param reports
+     * @return false if the file couldn't be written
+     */
+    static bool writeJSON(const string &path, const vector<SceneReport> &reports) {
+        FILE *file = path == "-" ? stdout : fopen(path.c_str(), "w");
+        if (!file) return false;
+
+        fputs("[\n", file);
+        for (size_t r = 0; r < reports.size(); r++)
+            fprintf(file, "  %s%s\n", reports[r].toJSON().c_str(), r + 1 < reports.size() ? "," : "");
+        fputs("]\n", file);
+
+        bool ok = !ferror(file);
+        if (file != stdout) ok &= fclose(file) == 0;
+        return ok;
+    }
+
+private:
+    static string quote(const string &text) {
+        string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+};
+
+
+#endif //RAYTRACER_STATS_H
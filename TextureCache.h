@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <CImg.h>
+#include "glm.hpp"
+#include "OBJParser.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace glm;
+using namespace cimg_library;
+
+#ifndef RAYTRACER_TEXTURECACHE_H
+#define RAYTRACER_TEXTURECACHE_H
+
+
+/**
+ * Tiled file of a texture, written next to its image as <image>.rttex.
+ *
+ * It holds the whole mip-map pyramid of the image, each level half the size of the previous one down to 1 x 1,
+ * cut into tiles of TILE x TILE RGBA texels: 4 KB, a page. Tiles on the right and bottom edges of a level are padded
+ * with copies of its last texels, so every tile has the same size. The tiles of a level follow each other row by row,
+ * and the levels from the largest one, after the header and the path of the image.
+ * The file is only used while the image keeps the size and modification time it was built from.
+ */
+struct TextureFileHeader {
+    static const uint32_t VERSION = 1;
+    static const int TILE = 32;
+
+    char magic[8] = {'R', 'T', 'T', 'E', 'X', 0, 0, 0};
+    uint32_t version = VERSION;
+    uint32_t tile = TILE;
+
+    uint64_t sourceSize = 0;
+    int64_t sourceSeconds = 0;      // Modification time of the image
+    int64_t sourceNanoseconds = 0;
+    uint64_t pathLength = 0;
+
+    uint32_t width = 0, height = 0; // Of the image, the first level
+    uint32_t levels = 0;
+    uint32_t reserved = 0;
+};
+
+
+/**
+ * Textures of the scenes, read tile by tile from their tiled files into a cache of bounded size.
+ *
+ * Only the tiles of the mip-map levels the rays need are read, and they stay in memory while there is room for them:
+ * past the budget, the least recently used tile makes room for the next one. The tiles are spread over shards,
+ * each one with its own lock and its share of the budget, so that the render threads rarely wait for each other.
+ * Texels are copied out of the cache under the lock of their shard, a tile can be evicted as soon as it is released.
+ */
+class TextureCache {
+public:
+    static const int TILE = TextureFileHeader::TILE;
+    static const size_t TILE_BYTES = TILE * TILE * 4;
+
+    /**
+     * @param budget Bytes of tiles kept in memory at most
+     */
+    explicit TextureCache(size_t budget) {
+        setBudget(budget);
+    }
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    ~TextureCache() {
+        for (const Texture &texture : textures)
+            close(texture.fd);
+    }
+
+    /**
+     * Bytes of tiles kept in memory at most, whatever the number and size of the textures.
+     * A smaller budget takes effect as new tiles are read.
+     * @param budget
+     */
+    void setBudget(size_t budget) {
+        tilesPerShard = glm::max((size_t) 1, budget / TILE_BYTES / SHARDS);
+    }
+
+    size_t budget() const { return tilesPerShard * SHARDS * TILE_BYTES; }
+
+    /**
+     * Add a texture, reading its tiled file, or making it from the image if there is none up to date.
+     * Images are loaded by CImg. When the tiled file can't be written next to the image, a temporary one is used.
+     *
+     * @param path Of the image
+     * @return Index of the texture, the same one for a path already given, -1 if the image can't be read
+     */
+    int open(const string &path) {
+        for (int t = 0; t < textures.size(); t++) {
+            if (textures[t].path == path)
+                return t;
+        }
+
+        Texture texture;
+        texture.path = path;
+        texture.fd = openTiledFile(path, texture.header);
+        if (texture.fd < 0)
+            return -1;
+
+        // Where each level starts in the file
+        uint64_t offset = tilesStart(texture.header);
+        for (int l = 0; l < texture.header.levels; l++) {
+            Level level;
+            level.width = glm::max(1, (int) texture.header.width >> l);
+            level.height = glm::max(1, (int) texture.header.height >> l);
+            level.tilesX = (level.width + TILE - 1) / TILE;
+            level.offset = offset;
+            offset += (uint64_t) level.tilesX * ((level.height + TILE - 1) / TILE) * TILE_BYTES;
+            texture.levels.push_back(level);
+        }
+
+        textures.push_back(texture);
+        return textures.size() - 1;
+    }
+
+    int width(int texture) const { return textures[texture].header.width; }
+
+    int height(int texture) const { return textures[texture].header.height; }
+
+    /**
+     * Filtered color of a texture, repeated over the texture coordinates.
+     * The mip-map level is the one whose texels are as wide as the footprint, blended with the next one (trilinear).
+     * v goes up the image, as in OBJ files.
+     *
+     * @param texture
+     * @param uv
+     * @param footprint Width of the area seen, in texture coordinates
+     * @return RGB, each in [0, 1]
+     */
+    vec3 sample(int texture, const vec2 &uv, float footprint) const {
+        const Texture &tex = textures[texture];
+        RayCounters::count(&RayCounters::textureSamples);
+
+        int size = glm::max(tex.header.width, tex.header.height);
+        float lod = std::log2(glm::max(footprint * size, 1e-6f));
+        lod = glm::min(glm::max(lod, 0.f), (float) (tex.levels.size() - 1));
+
+        int level = (int) lod;
+        float blend = lod - level;
+        vec3 color = bilinear(tex, texture, level, uv);
+        if (blend > 0 && level + 1 < tex.levels.size())
+            color = color * (1 - blend) + bilinear(tex, texture, level + 1, uv) * blend;
+        return color;
+    }
+
+private:
+    static const int SHARDS = 16;
+
+    struct Level {
+        int width, height;
+        int tilesX;
+        uint64_t offset;            // Of its first tile in the file
+    };
+
+    struct Texture {
+        string path;
+        int fd = -1;
+        TextureFileHeader header;
+        vector<Level> levels;
+    };
+
+    struct Tile {
+        uint64_t key;
+        unsigned char texels[TILE_BYTES];
+    };
+
+    struct Shard {
+        mutex lock;
+        list<Tile> tiles;           // Most recently used first
+        unordered_map<uint64_t, list<Tile>::iterator> index;
+    };
+
+    vector<Texture> textures;
+    size_t tilesPerShard = 1;
+    mutable Shard shards[SHARDS];
+
+    static uint64_t tilesStart(const TextureFileHeader &header) {
+        return (sizeof(TextureFileHeader) + header.pathLength + TILE_BYTES - 1) / TILE_BYTES * TILE_BYTES;
+    }
+
+    /**
+     * Bilinear filtering of the four texels around a point of a level
+     * @param tex
+     * @param texture
+     * @param level
+     * @param uv
+     * @return
+     */
+    vec3 bilinear(const Texture &tex, int texture, int level, const vec2 &uv) const {
+        const Level &l = tex.levels[level];
+        float x = (uv.x - std::floor(uv.x)) * l.width - 0.5f;
+        float y = (1 - (uv.y - std::floor(uv.y))) * l.height - 0.5f;
+        float x0 = std::floor(x), y0 = std::floor(y);
+        float fx = x - x0, fy = y - y0;
+
+        // Repeated on every side
+        int xs[2] = {wrap((int) x0, l.width), wrap((int) x0 + 1, l.width)};
+        int ys[2] = {wrap((int) y0, l.height), wrap((int) y0 + 1, l.height)};
+        vec3 texels[4];
+        fetch(tex, texture, level, xs, ys, texels);
+
+        return (texels[0] * (1 - fx) + texels[1] * fx) * (1 - fy) + (texels[2] * (1 - fx) + texels[3] * fx) * fy;
+    }
+
+    static int wrap(int x, int size) {
+        x %= size;
+        return x < 0 ? x + size : x;
+    }
+
+    /**
+     * Copy the four texels of a 2 x 2 block out of the cache, locking each tile they are in once
+     * @param tex
+     * @param texture
+     * @param level
+     * @param xs Columns of the block
+     * @param ys Rows
+     * @param texels Row by row
+     */
+    void fetch(const Texture &tex, int texture, int level, const int xs[2], const int ys[2], vec3 texels[4]) const {
+        bool done[4] = {false, false, false, false};
+        for (int k = 0; k < 4; k++) {
+            if (done[k]) continue;
+            int tileX = xs[k & 1] / TILE, tileY = ys[k >> 1] / TILE;
+
+            withTile(tex, texture, level, tileX, tileY, [&](const unsigned char *tile) {
+                for (int n = k; n < 4; n++) {
+                    int x = xs[n & 1], y = ys[n >> 1];
+                    if (done[n] || x / TILE != tileX || y / TILE != tileY) continue;
+
+                    const unsigned char *texel = tile + ((y % TILE) * TILE + x % TILE) * 4;
+                    texels[n] = vec3(texel[0], texel[1], texel[2]) * (1 / 255.f);
+                    done[n] = true;
+                }
+            });
+        }
+    }
+
+    /**
+     * Call use with the texels of a tile, holding the lock of its shard.
+     * A tile that isn't in the cache is read from the file, in place of the least recently used one if the shard is full.
+     *
+     * @param tex
+     * @param texture
+     * @param level
+     * @param tileX
+     * @param tileY
+     * @param use
+     */
+    template<typename Use>
+    void withTile(const Texture &tex, int texture, int level, int tileX, int tileY, Use &&use) const {
+        const Level &l = tex.levels[level];
+        uint64_t tile = (uint64_t) tileY * l.tilesX + tileX;
+        uint64_t key = (uint64_t) texture << 40 | (uint64_t) level << 32 | tile;
+        Shard &shard = shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % SHARDS];
+
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            shard.tiles.splice(shard.tiles.begin(), shard.tiles, found->second);
+            use(found->second->texels);
+            return;
+        }
+
+        // Reuse the least recently used tile once the shard is full
+        if (shard.tiles.size() >= tilesPerShard) {
+            shard.index.erase(shard.tiles.back().key);
+            shard.tiles.splice(shard.tiles.begin(), shard.tiles, prev(shard.tiles.end()));
+            RayCounters::count(&RayCounters::textureTilesEvicted);
+        } else {
+            shard.tiles.emplace_front();
+        }
+
+        Tile &entry = shard.tiles.front();
+        entry.key = key;
+        if (!readAt(tex.fd, entry.texels, TILE_BYTES, l.offset + tile * TILE_BYTES)) {
+            cerr << "Unable to read a tile of " << tex.path << endl;
+            memset(entry.texels, 0, TILE_BYTES);
+        }
+        shard.index[key] = shard.tiles.begin();
+        RayCounters::count(&RayCounters::textureTilesRead);
+        use(entry.texels);
+    }
+
+    static bool readAt(int fd, void *data, size_t bytes, uint64_t offset) {
+        char *p = (char *) data;
+        while (bytes > 0) {
+            ssize_t n = pread(fd, p, bytes, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            offset += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    /**
+     * Open the tiled file of an image, making it first unless it is up to date
+     * @param path
+     * @param header Gets the header of the file
+     * @return The file descriptor, -1 if the image can't be read
+     */
+    static int openTiledFile(const string &path, TextureFileHeader &header) {
+        TextureFileHeader key;
+        if (!fileStamp(path, key.sourceSize, key.sourceSeconds, key.sourceNanoseconds)) {
+            cerr << "Unable to open the texture " << path << endl;
+            return -1;
+        }
+
+        string tiledPath = path + ".rttex";
+        int fd = ::open(tiledPath.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            if (readAt(fd, &header, sizeof(header), 0) && memcmp(header.magic, key.magic, sizeof(key.magic)) == 0
+                && header.version == TextureFileHeader::VERSION && header.tile == TILE
+                && header.sourceSize == key.sourceSize && header.sourceSeconds == key.sourceSeconds
+                && header.sourceNanoseconds == key.sourceNanoseconds && header.pathLength == path.size())
+                return fd;
+            close(fd);
+        }
+
+        vector<vector<unsigned char>> levels;
+        if (!loadLevels(path, key, levels))
+            return -1;
+        header = key;
+        header.pathLength = path.size();
+
+        // Written under a temporary name and renamed once complete, like the mesh cache
+        string temporary = tiledPath + "." + to_string(getpid());
+        if (writeTiledFile(temporary, header, path, levels) && rename(temporary.c_str(), tiledPath.c_str()) == 0)
+            return ::open(tiledPath.c_str(), O_RDONLY);
+        remove(temporary.c_str());
+
+        // Next to the image is read-only: a file of our own, gone once closed
+        FILE *file = tmpfile();
+        if (!file) {
+            cerr << "Unable to write the tiles of " << path << endl;
+            return -1;
+        }
+        fd = dup(fileno(file));
+        fclose(file);
+        if (fd < 0 || !writeTiles(fd, header, path, levels)) {
+            cerr << "Unable to write the tiles of " << path << endl;
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /**
+     * Load an image and compute its mip-map levels, RGBA texels row by row
+     * @param path
+     * @param header Gets the size and level count
+     * @param levels
+     * @return false if the image can't be read
+     */
+    static bool loadLevels(const string &path, TextureFileHeader &header, vector<vector<unsigned char>> &levels) {
+        CImg<unsigned char> image;
+        try {
+            image.load(path.c_str());
+        } catch (const CImgException &) {
+            image = CImg<unsigned char>();
+        }
+        if (image.width() <= 0 || image.height() <= 0) {
+            cerr << "Unable to read the texture " << path << endl;
+            return false;
+        }
+
+        int width = image.width(), height = image.height();
+        header.width = width;
+        header.height = height;
+        header.levels = 1;
+        while ((width >> header.levels) > 0 || (height >> header.levels) > 0)
+            header.levels++;
+
+        // Gray, gray and alpha, RGB or RGBA
+        vector<unsigned char> first((size_t) width * height * 4);
+        int channels = image.spectrum();
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                unsigned char *texel = &first[((size_t) y * width + x) * 4];
+                for (int c = 0; c < 3; c++)
+                    texel[c] = image(x, y, 0, channels >= 3 ? c : 0);
+                texel[3] = channels == 2 || channels >= 4 ? image(x, y, 0, channels - 1) : 255;
+            }
+        }
+        levels.push_back(std::move(first));
+
+        // Each level averages 2 x 2 texels of the previous one, the last row or column counting twice on odd sizes
+        for (int l = 1; l < header.levels; l++) {
+            int w = glm::max(1, width >> l), h = glm::max(1, height >> l);
+            int pw = glm::max(1, width >> (l - 1)), ph = glm::max(1, height >> (l - 1));
+            const vector<unsigned char> &previous = levels.back();
+            vector<unsigned char> level((size_t) w * h * 4);
+
+            for (int y = 0; y < h; y++) {
+                int y0 = glm::min(2 * y, ph - 1), y1 = glm::min(2 * y + 1, ph - 1);
+                for (int x = 0; x < w; x++) {
+                    int x0 = glm::min(2 * x, pw - 1), x1 = glm::min(2 * x + 1, pw - 1);
+                    for (int c = 0; c < 4; c++) {
+                        int sum = previous[((size_t) y0 * pw + x0) * 4 + c] + previous[((size_t) y0 * pw + x1) * 4 + c]
+                                  + previous[((size_t) y1 * pw + x0) * 4 + c] + previous[((size_t) y1 * pw + x1) * 4 + c];
+                        level[((size_t) y * w + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+                    }
+                }
+            }
+            levels.push_back(std::move(level));
+        }
+        return true;
+    }
+
+    static bool writeTiledFile(const string &tiledPath, const TextureFileHeader &header, const string &path,
+                               const vector<vector<unsigned char>> &levels) {
+        int fd = ::open(tiledPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        bool written = writeTiles(fd, header, path, levels);
+        return close(fd) == 0 && written;
+    }
+
+    /**
+     * Write the header, the path of the image and the tiles of every level
+     * @param fd
+     * @param header
+     * @param path
+     * @param levels
+     * @return
+     */
+    static bool writeTiles(int fd, const TextureFileHeader &header, const string &path,
+                           const vector<vector<unsigned char>> &levels) {
+        vector<unsigned char> start(tilesStart(header), 0);
+        memcpy(start.data(), &header, sizeof(header));
+        memcpy(start.data() + sizeof(header), path.data(), path.size());
+        if (!writeAt(fd, start.data(), start.size(), 0))
+            return false;
+
+        uint64_t offset = start.size();
+        unsigned char tile[TILE_BYTES];
+        for (int l = 0; l < levels.size(); l++) {
+            int w = glm::max(1, (int) header.width >> l), h = glm::max(1, (int) header.height >> l);
+            for (int ty = 0; ty < h; ty += TILE) {
+                for (int tx = 0; tx < w; tx += TILE) {
+                    // Padded with the last texels of the level
+                    for (int y = 0; y < TILE; y++) {
+                        int sy = glm::min(ty + y, h - 1);
+                        for (int x = 0; x < TILE; x++) {
+                            int sx = glm::min(tx + x, w - 1);
+                            memcpy(tile + (y * TILE + x) * 4, &levels[l][((size_t) sy * w + sx) * 4], 4);
+                        }
+                    }
+                    if (!writeAt(fd, tile, TILE_BYTES, offset))
+                        return false;
+                    offset += TILE_BYTES;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool writeAt(int fd, const void *data, size_t bytes, uint64_t offset) {
+        const char *p = (const char *) data;
+        while (bytes > 0) {
+            ssize_t n = pwrite(fd, p, bytes, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            offset += n;
+            bytes -= n;
+        }
+        return true;
+    }
+};
+
+
+#endif //RAYTRACER_TEXTURECACHE_H
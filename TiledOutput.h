@@ -0,0 +1,713 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <CImg.h>
+#include "glm.hpp"
+#include "Renderer.h"
+
+using namespace std;
+using namespace cimg_library;
+
+#ifndef RAYTRACER_TILEDOUTPUT_H
+#define RAYTRACER_TILEDOUTPUT_H
+
+
+/**
+ * Float image file written tile by tile, in any order, as the tiles of a render finish.
+ * The file is laid out at its full size when opened, so that each tile goes straight to its place
+ * and the image never has to be held in memory. Values are stored on the 0-1 scale.
+ */
+class TiledImage {
+public:
+    virtual ~TiledImage() { close(); }
+
+    /**
+     * Writer for the format given by the extension of the path: .pfm, or .exr (tiled, uncompressed)
+     * @param path
+     * @param half Store half floats rather than floats, in EXR files
+     * @return null for other extensions
+     */
+    static unique_ptr<TiledImage> forPath(const string &path, bool half);
+
+    /**
+     * Create the file, or keep the existing one to resume a render, if it has the expected size
+     * @param filePath
+     * @param imageWidth
+     * @param imageHeight
+     * @param tiles Size of the tiles, which start at multiples of it
+     * @param keep Keep the pixels of an existing file
+     * @return false if the file couldn't be created
+     */
+    bool open(const string &filePath, int imageWidth, int imageHeight, int tiles, bool keep) {
+        path = filePath;
+        width = imageWidth;
+        height = imageHeight;
+        tileSize = tiles;
+        layout();
+
+        struct stat info;
+        kept = keep && stat(path.c_str(), &info) == 0 && (size_t) info.st_size == fileSize();
+        fd = ::open(path.c_str(), kept ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        // A file of the right size laid out differently is rendered again from scratch
+        if (fd >= 0 && kept && !sameLayout())
+            kept = false;
+        if (fd < 0 || (!kept && ftruncate(fd, fileSize()) != 0) || !writeHeader()) {
+            cerr << "Unable to create " << path << endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Were the pixels of an existing file kept by open()
+     * @return
+     */
+    bool resumed() const { return kept; }
+
+    /**
+     * Write the pixels of a finished tile
+     * @param tile
+     * @param image Pixels of the window, on the 0-255 scale
+     * @param window Holding the tile
+     * @return false if the file couldn't be written
+     */
+    virtual bool writeTile(const Tile &tile, const CImg<float> &image, const Window &window) = 0;
+
+    /**
+     * Read rows back, as interleaved RGB
+     * @param y0 First row
+     * @param y1 Past the last row
+     * @param rgb Resized to the pixels of the rows, on the 0-1 scale
+     * @return false if the file couldn't be read
+     */
+    virtual bool readRows(int y0, int y1, vector<float> &rgb) const = 0;
+
+    int imageWidth() const { return width; }
+
+    int imageHeight() const { return height; }
+
+    int tiles() const { return tileSize; }
+
+    bool close() {
+        bool ok = fd < 0 || ::close(fd) == 0;
+        fd = -1;
+        return ok;
+    }
+
+protected:
+    string path;
+    int fd = -1;
+    int width = 0, height = 0;
+    int tileSize = 32;
+    bool kept = false;
+
+    // Place of everything in the file, once the size of the image is known
+    virtual void layout() = 0;
+
+    virtual size_t fileSize() const = 0;
+
+    // Does the file opened hold the header this image would write
+    virtual bool sameLayout() const = 0;
+
+    // Everything but the pixels, written again when a file is resumed
+    virtual bool writeHeader() = 0;
+
+    bool writeAt(const void *data, size_t size, size_t offset) {
+        const char *bytes = (const char *) data;
+        while (size > 0) {
+            ssize_t written = pwrite(fd, bytes, size, offset);
+            if (written <= 0) return false;
+            bytes += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    bool readAt(void *data, size_t size, size_t offset) const {
+        char *bytes = (char *) data;
+        while (size > 0) {
+            ssize_t read = pread(fd, bytes, size, offset);
+            if (read <= 0) return false;
+            bytes += read;
+            size -= read;
+            offset += read;
+        }
+        return true;
+    }
+
+    static bool littleEndian() {
+        uint16_t one = 1;
+        return *(const uint8_t *) &one == 1;
+    }
+};
+
+
+/**
+ * Portable float map: a text header, then RGB floats from the bottom row to the top one
+ */
+class PFMImage : public TiledImage {
+    string header;
+
+public:
+    bool writeTile(const Tile &tile, const CImg<float> &image, const Window &window) override {
+        vector<float> row((tile.x1 - tile.x0) * 3);
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                for (int c = 0; c < 3; c++)
+                    row[(x - tile.x0) * 3 + c] = image(x - window.x0, y - window.y0, 0, c) / 255.f;
+            }
+            if (!writeAt(row.data(), row.size() * sizeof(float), pixelOffset(tile.x0, y)))
+                return false;
+        }
+        return true;
+    }
+
+    bool readRows(int y0, int y1, vector<float> &rgb) const override {
+        rgb.resize((size_t) (y1 - y0) * width * 3);
+        for (int y = y0; y < y1; y++) {
+            if (!readAt(&rgb[(size_t) (y - y0) * width * 3], (size_t) width * 3 * sizeof(float), pixelOffset(0, y)))
+                return false;
+        }
+        return true;
+    }
+
+protected:
+    void layout() override {
+        // A negative scale tells the floats are little endian
+        header = "PF\n" + to_string(width) + " " + to_string(height) + "\n" + (littleEndian() ? "-1.0" : "1.0") + "\n";
+    }
+
+    size_t fileSize() const override {
+        return header.size() + (size_t) width * height * 3 * sizeof(float);
+    }
+
+    bool sameLayout() const override {
+        string existing(header.size(), 0);
+        return readAt(&existing[0], existing.size(), 0) && existing == header;
+    }
+
+    bool writeHeader() override {
+        return writeAt(header.data(), header.size(), 0);
+    }
+
+private:
+    size_t pixelOffset(int x, int y) const {
+        return header.size() + ((size_t) (height - 1 - y) * width + x) * 3 * sizeof(float);
+    }
+};
+
+
+/**
+ * Tiled OpenEXR file, single level and uncompressed, with B, G and R channels of floats or half floats.
+ * Uncompressed chunks all have a known size, so they are laid out with their offset table up front.
+ * Each chunk holds one tile: its coordinates, then each of its rows, channel after channel.
+ */
+class EXRImage : public TiledImage {
+    bool half;
+    vector<char> header;
+    vector<uint64_t> offsets;   // Of the chunk of each tile, row after row
+    int columns = 0, rows = 0;  // Of tiles
+    size_t size = 0;
+
+public:
+    EXRImage(bool half) : half(half) {}
+
+    bool writeTile(const Tile &tile, const CImg<float> &image, const Window &window) override {
+        // Render tiles start on the grid of the file, so each one falls in a single chunk
+        int tx = tile.x0 / tileSize, ty = tile.y0 / tileSize;
+        int chunkWidth, chunkHeight;
+        chunkSize(tx, ty, chunkWidth, chunkHeight);
+
+        // Pixels of the chunk missed by the tile stay black
+        vector<char> chunk(CHUNK_HEADER + (size_t) chunkWidth * chunkHeight * 3 * sampleSize(), 0);
+        int32_t coordinates[5] = {tx, ty, 0, 0, (int32_t) (chunk.size() - CHUNK_HEADER)};
+        memcpy(chunk.data(), coordinates, CHUNK_HEADER);
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int c = 0; c < 3; c++) {
+                // Channels sorted by name: B, G, R
+                char *out = &chunk[CHUNK_HEADER + ((size_t) (y - ty * tileSize) * 3 + c) * chunkWidth * sampleSize()];
+                for (int x = tile.x0; x < tile.x1; x++) {
+                    float value = image(x - window.x0, y - window.y0, 0, 2 - c) / 255.f;
+                    storeSample(out + (size_t) (x - tx * tileSize) * sampleSize(), value);
+                }
+            }
+        }
+        return writeAt(chunk.data(), chunk.size(), offsets[ty * columns + tx]);
+    }
+
+    bool readRows(int y0, int y1, vector<float> &rgb) const override {
+        rgb.assign((size_t) (y1 - y0) * width * 3, 0);
+        vector<char> data;
+
+        for (int ty = y0 / tileSize; ty * tileSize < y1; ty++) {
+            for (int tx = 0; tx < columns; tx++) {
+                int chunkWidth, chunkHeight;
+                chunkSize(tx, ty, chunkWidth, chunkHeight);
+                data.resize((size_t) chunkWidth * chunkHeight * 3 * sampleSize());
+                if (!readAt(data.data(), data.size(), offsets[ty * columns + tx] + CHUNK_HEADER))
+                    return false;
+
+                for (int y = glm::max(y0, ty * tileSize); y < glm::min(y1, ty * tileSize + chunkHeight); y++) {
+                    for (int c = 0; c < 3; c++) {
+                        const char *in = &data[((size_t) (y - ty * tileSize) * 3 + c) * chunkWidth * sampleSize()];
+                        float *out = &rgb[((size_t) (y - y0) * width + tx * tileSize) * 3 + 2 - c];
+                        for (int x = 0; x < chunkWidth; x++)
+                            out[x * 3] = loadSample(in + (size_t) x * sampleSize());
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+protected:
+    void layout() override {
+        columns = (width + tileSize - 1) / tileSize;
+        rows = (height + tileSize - 1) / tileSize;
+        header.clear();
+
+        // Magic number, then version 2 with the tiled flag
+        putInt(0x01312f76);
+        putInt(2 | 0x200);
+
+        // Channels: name, pixel type (1 half, 2 float), linear flag, 3 reserved bytes, x and y sampling
+        attribute("channels", "chlist", 3 * 18 + 1);
+        for (const char *channel : {"B", "G", "R"}) {
+            putString(channel);
+            putInt(half ? 1 : 2);
+            putInt(0);
+            putInt(1);
+            putInt(1);
+        }
+        header.push_back(0);
+
+        attribute("compression", "compression", 1);
+        header.push_back(0);
+        for (const char *window : {"dataWindow", "displayWindow"}) {
+            attribute(window, "box2i", 16);
+            putInt(0);
+            putInt(0);
+            putInt(width - 1);
+            putInt(height - 1);
+        }
+        attribute("lineOrder", "lineOrder", 1);
+        header.push_back(0);
+        attribute("pixelAspectRatio", "float", 4);
+        putFloat(1);
+        attribute("screenWindowCenter", "v2f", 8);
+        putFloat(0);
+        putFloat(0);
+        attribute("screenWindowWidth", "float", 4);
+        putFloat(1);
+
+        // Tile size, then a single level with rounding down
+        attribute("tiles", "tiledesc", 9);
+        putInt(tileSize);
+        putInt(tileSize);
+        header.push_back(0);
+
+        // End of the attributes
+        header.push_back(0);
+
+        // Chunks after the offset table, in row order
+        offsets.resize((size_t) columns * rows);
+        size_t offset = header.size() + offsets.size() * sizeof(uint64_t);
+        for (int ty = 0; ty < rows; ty++) {
+            for (int tx = 0; tx < columns; tx++) {
+                int chunkWidth, chunkHeight;
+                chunkSize(tx, ty, chunkWidth, chunkHeight);
+                offsets[ty * columns + tx] = offset;
+                offset += CHUNK_HEADER + (size_t) chunkWidth * chunkHeight * 3 * sampleSize();
+            }
+        }
+        size = offset;
+    }
+
+    size_t fileSize() const override {
+        return size;
+    }
+
+    /**
+     * Walk the attributes of the file the way an EXR reader does, up to the null byte ending them.
+     * They have to end where the header of this image does, with the same values.
+     * @return
+     */
+    bool sameLayout() const override {
+        vector<char> existing(header.size());
+        if (!readAt(existing.data(), existing.size(), 0))
+            return false;
+
+        // Past the magic number and version
+        size_t p = 8;
+        while (p < existing.size() && existing[p] != 0) {
+            // Name and type, null terminated, then the size of the value
+            for (int s = 0; s < 2; s++) {
+                const char *end = (const char *) memchr(existing.data() + p, 0, existing.size() - p);
+                if (!end) return false;
+                p = end - existing.data() + 1;
+            }
+            int32_t valueSize;
+            if (p + sizeof(valueSize) > existing.size()) return false;
+            memcpy(&valueSize, existing.data() + p, sizeof(valueSize));
+            if (valueSize < 0) return false;
+            p += sizeof(valueSize) + valueSize;
+        }
+        return p + 1 == existing.size() && existing == header;
+    }
+
+    bool writeHeader() override {
+        if (!writeAt(header.data(), header.size(), 0) ||
+            !writeAt(offsets.data(), offsets.size() * sizeof(uint64_t), header.size()))
+            return false;
+
+        // Coordinates of every chunk, so that tiles never rendered read as black
+        for (int ty = 0; ty < rows; ty++) {
+            for (int tx = 0; tx < columns; tx++) {
+                int chunkWidth, chunkHeight;
+                chunkSize(tx, ty, chunkWidth, chunkHeight);
+                int32_t coordinates[5] = {tx, ty, 0, 0, (int32_t) ((size_t) chunkWidth * chunkHeight * 3 * sampleSize())};
+                if (!writeAt(coordinates, CHUNK_HEADER, offsets[ty * columns + tx]))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static const size_t CHUNK_HEADER = 5 * sizeof(int32_t);
+
+    size_t sampleSize() const { return half ? 2 : 4; }
+
+    /**
+     * Size of a tile of the file, smaller on the right and bottom edges
+     */
+    void chunkSize(int tx, int ty, int &chunkWidth, int &chunkHeight) const {
+        chunkWidth = glm::min(tileSize, width - tx * tileSize);
+        chunkHeight = glm::min(tileSize, height - ty * tileSize);
+    }
+
+    void storeSample(char *out, float value) const {
+        if (half) {
+            uint16_t bits = floatToHalf(value);
+            memcpy(out, &bits, 2);
+        } else {
+            memcpy(out, &value, 4);
+        }
+    }
+
+    float loadSample(const char *in) const {
+        if (half) {
+            uint16_t bits;
+            memcpy(&bits, in, 2);
+            return halfToFloat(bits);
+        }
+        float value;
+        memcpy(&value, in, 4);
+        return value;
+    }
+
+    /**
+     * Nearest half float, flushing the ones too small for a normal half to zero
+     * @param value
+     * @return
+     */
+    static uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        if (exponent <= 0) return sign;
+        if (exponent >= 31) return sign | 0x7c00;
+
+        // Round to nearest, a carry going into the exponent
+        uint32_t half = ((uint32_t) exponent << 10 | mantissa >> 13) + ((mantissa >> 12) & 1);
+        return sign | (uint16_t) glm::min(half, 0x7c00u);
+    }
+
+    static float halfToFloat(uint16_t bits) {
+        uint32_t sign = (uint32_t) (bits & 0x8000) << 16;
+        uint32_t exponent = (bits >> 10) & 0x1f;
+        uint32_t mantissa = bits & 0x3ff;
+        uint32_t result;
+
+        if (exponent == 0)
+            result = sign;  // Zero, the subnormals never being written
+        else if (exponent == 31)
+            result = sign | 0x7f800000 | mantissa << 13;
+        else
+            result = sign | (exponent - 15 + 127) << 23 | mantissa << 13;
+
+        float value;
+        memcpy(&value, &result, 4);
+        return value;
+    }
+
+    void attribute(const char *name, const char *type, int valueSize) {
+        putString(name);
+        putString(type);
+        putInt(valueSize);
+    }
+
+    void putString(const char *text) {
+        header.insert(header.end(), text, text + strlen(text) + 1);
+    }
+
+    void putInt(int32_t value) {
+        header.insert(header.end(), (const char *) &value, (const char *) &value + 4);
+    }
+
+    void putFloat(float value) {
+        header.insert(header.end(), (const char *) &value, (const char *) &value + 4);
+    }
+};
+
+
+unique_ptr<TiledImage> TiledImage::forPath(const string &path, bool half) {
+    string extension = path.substr(path.find_last_of('.') + 1);
+    for (char &c : extension) c = tolower(c);
+
+    if (extension == "pfm")
+        return unique_ptr<TiledImage>(new PFMImage());
+    if (extension == "exr")
+        return unique_ptr<TiledImage>(new EXRImage(half));
+    return nullptr;
+}
+
+
+/**
+ * Tiles already written to a tiled image, one per line after a line describing the render,
+ * so that a render stopped halfway resumes from where it was.
+ * Each tile is only added once its pixels are written, and the file is flushed right away.
+ */
+class TileJournal {
+    string path;
+    FILE *file = nullptr;
+    vector<bool> done;
+    size_t doneCount = 0;
+    mutex lock;
+
+public:
+    ~TileJournal() { close(); }
+
+    /**
+     * Read the tiles written by an earlier run of the same render, then keep adding to the file
+     * @param journalPath
+     * @param key Describes the render, a journal written for another one is started over
+     * @param tileCount
+     * @return false if the file couldn't be written
+     */
+    bool open(const string &journalPath, const string &key, size_t tileCount) {
+        path = journalPath;
+        done.assign(tileCount, false);
+        doneCount = 0;
+
+        string firstLine = "raytracer tiles " + key + "\n";
+        FILE *previous = fopen(path.c_str(), "r");
+        if (previous) {
+            string content;
+            char buffer[4096];
+            size_t read;
+            while ((read = fread(buffer, 1, sizeof(buffer), previous)) > 0)
+                content.append(buffer, read);
+            fclose(previous);
+
+            // Only complete lines count, the last one may have been cut short
+            if (content.compare(0, firstLine.size(), firstLine) == 0) {
+                size_t start = firstLine.size(), end;
+                while ((end = content.find('\n', start)) != string::npos) {
+                    long tile = atol(content.c_str() + start);
+                    if (tile >= 0 && tile < (long) tileCount && !done[tile]) {
+                        done[tile] = true;
+                        doneCount++;
+                    }
+                    start = end + 1;
+                }
+            }
+        }
+
+        return doneCount > 0 ? reopen(nullptr) : reopen(firstLine.c_str());
+    }
+
+    /**
+     * Forget the tiles written, when the image they went to is gone
+     * @param key
+     * @return
+     */
+    bool restart(const string &key) {
+        done.assign(done.size(), false);
+        doneCount = 0;
+        return reopen(("raytracer tiles " + key + "\n").c_str());
+    }
+
+    bool isDone(size_t tile) const { return done[tile]; }
+
+    size_t count() const { return doneCount; }
+
+    /**
+     * Record a tile whose pixels are written, from any thread
+     * @param tile
+     * @return false if the journal couldn't be written
+     */
+    bool markDone(size_t tile) {
+        lock_guard<mutex> guard(lock);
+        if (!done[tile]) {
+            done[tile] = true;
+            doneCount++;
+        }
+        return fprintf(file, "%zu\n", tile) > 0 && fflush(file) == 0;
+    }
+
+    /**
+     * Delete the journal, once the image is complete
+     * @return
+     */
+    bool remove() {
+        close();
+        return std::remove(path.c_str()) == 0;
+    }
+
+    void close() {
+        if (file) fclose(file);
+        file = nullptr;
+    }
+
+private:
+    /**
+     * Open the file for appending, or start it over with the given first line
+     * @param firstLine null to append
+     * @return
+     */
+    bool reopen(const char *firstLine) {
+        close();
+        file = fopen(path.c_str(), firstLine ? "w" : "a");
+        if (!file || (firstLine && (fputs(firstLine, file) < 0 || fflush(file) != 0))) {
+            cerr << "Unable to write " << path << endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+
+/**
+ * Write an 8 bits PNG preview of a tiled image, reading it back a band of rows at a time.
+ * Images larger than maxSize are shrunk by a whole factor, averaging blocks of pixels.
+ * The image data is stored without compression, there being no zlib to depend on.
+ *
+ * @param image
+ * @param path
+ * @param maxSize Width and height at most
+ * @return false if the image couldn't be read or the preview written
+ */
+bool writePNGPreview(const TiledImage &image, const string &path, int maxSize = 2048) {
+    int factor = (glm::max(image.imageWidth(), image.imageHeight()) + maxSize - 1) / maxSize;
+    int width = image.imageWidth() / factor, height = image.imageHeight() / factor;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    uint32_t crcTable[256];
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crcTable[n] = c;
+    }
+    auto bigEndian = [](vector<uint8_t> &out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((uint8_t) (value >> shift));
+    };
+    auto writeChunk = [&](const char *type, const vector<uint8_t> &data) {
+        vector<uint8_t> chunk;
+        bigEndian(chunk, data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = 4; i < chunk.size(); i++)
+            crc = crcTable[(crc ^ chunk[i]) & 0xff] ^ (crc >> 8);
+        bigEndian(chunk, crc ^ 0xffffffffu);
+        fwrite(chunk.data(), 1, chunk.size(), file);
+    };
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    // 8 bits RGB, no interlacing
+    vector<uint8_t> header;
+    bigEndian(header, width);
+    bigEndian(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    writeChunk("IHDR", header);
+
+    // One IDAT chunk per band, holding the stored deflate blocks of its rows
+    uint32_t adlerA = 1, adlerB = 0;
+    vector<float> rgb;
+    vector<uint8_t> row(1 + width * 3);
+    int band = glm::max(1, image.tiles() / factor) * factor;
+    bool ok = true;
+
+    for (int y0 = 0; y0 < height && ok; y0 += band / factor) {
+        int y1 = glm::min(y0 + band / factor, height);
+        ok = image.readRows(y0 * factor, y1 * factor, rgb);
+
+        vector<uint8_t> data;
+        if (y0 == 0)
+            data.insert(data.end(), {0x78, 0x01});  // zlib header, no dictionary
+
+        for (int y = y0; y < y1 && ok; y++) {
+            // Filter type 0, then the average of each block, rounded down like the BMP output
+            row[0] = 0;
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    float sum = 0;
+                    for (int dy = 0; dy < factor; dy++) {
+                        for (int dx = 0; dx < factor; dx++)
+                            sum += rgb[(((size_t) (y - y0) * factor + dy) * image.imageWidth() + x * factor + dx) * 3 + c];
+                    }
+                    float value = sum / (factor * factor) * 255.f + 0.0001f;
+                    row[1 + x * 3 + c] = (uint8_t) glm::clamp(value, 0.f, 255.f);
+                }
+            }
+            for (uint8_t byte : row) {
+                adlerA = (adlerA + byte) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+
+            // Stored blocks of at most 65535 bytes, the last one of the image flagged as final
+            for (size_t start = 0; start < row.size(); start += 65535) {
+                uint16_t length = (uint16_t) glm::min(row.size() - start, (size_t) 65535);
+                bool last = y == height - 1 && start + length == row.size();
+                data.insert(data.end(), {(uint8_t) last, (uint8_t) length, (uint8_t) (length >> 8),
+                                         (uint8_t) ~length, (uint8_t) (~length >> 8)});
+                data.insert(data.end(), row.begin() + start, row.begin() + start + length);
+            }
+        }
+        if (y1 == height)
+            bigEndian(data, adlerB << 16 | adlerA);
+        writeChunk("IDAT", data);
+    }
+
+    writeChunk("IEND", vector<uint8_t>());
+    ok &= !ferror(file);
+    ok &= fclose(file) == 0;
+    return ok;
+}
+
+
+#endif //RAYTRACER_TILEDOUTPUT_H
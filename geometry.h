@@ -1,6 +1,12 @@
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "NeededMath.h"
+#include "Animation.h"
+#include "Arena.h"
+#include "BVH.h"
+#include "Stats.h"
+#include "TextureCache.h"
 
 using namespace std;
 using namespace glm;
@@ -13,8 +19,21 @@ using namespace glm;
  * All surfaces materials struct
  */
 struct Material {
-    vec3 ambient, diffuse, specular;
-    float shininess;
+    vec3 ambient = vec3(), diffuse = vec3(), specular = vec3();
+    float shininess = 1;
+
+    // Share of the light coming from the mirror direction, and through the surface.
+    // What is left, 1 - reflectivity - transmission, is the Phong shading of the surface itself.
+    float reflectivity = 0;
+    float transmission = 0;
+    float ior = 1;          // Index of refraction of the inside of the object
+
+    // Textures of Scene::textures, -1 for none, multiplying the colors above over the texture coordinates of meshes.
+    // The diffuse map multiplies the ambient color too.
+    int diffuseMap = -1;
+    int specularMap = -1;
+
+    bool textured() const { return diffuseMap >= 0 || specularMap >= 0; }
 };
 
 /**
@@ -42,17 +61,34 @@ public:
 
     virtual double intersect(Ray ray){return INFINITY;}
     virtual vec3 getNormalAt(vec3 point){return vec3();}
+
+    /**
+     * Fill the box enclosing the object.
+     * Returns false for unbounded objects, which are kept out of the BVH.
+     *
+     * @param box
+     * @return
+     */
+    virtual bool getBounds(AABB &box){return false;}
 };
 
 /**
- * The camera
+ * The camera.
+ * It looks down -z unless given a point to look at, and its resolution follows from its focal length,
+ * unless given explicitly.
  */
 class Camera : public SceneObj {
 public:
-    float fov;
-    float focalLength;
+    float fov;                  // Vertical, in radians
+    float focalLength;          // In pixels: the height of the image is tan(fov / 2) * 2 * focalLength
     float aspectRatio;
 
+    bool aimed = false;         // Looks at target, rather than down -z
+    vec3 target = vec3();
+    vec3 up = vec3(0, 1, 0);
+
+    int width = 0, height = 0;  // Resolution, 0 for the one of the focal length
+
     Camera() {}
 
     Camera(const vec3 &pos) : SceneObj(pos) {}
@@ -62,28 +98,88 @@ public:
         this->focalLength = fl;
         this->aspectRatio = ar;
     }
+
+    /**
+     * Axes of the view
+     * @param right
+     * @param upward Up, square to the view direction
+     * @param forward View direction
+     */
+    void axes(vec3 &right, vec3 &upward, vec3 &forward) const {
+        // Exact axes for the default camera, its rays keeping the directions they had before cameras could turn
+        if (!aimed) {
+            right = vec3(1, 0, 0);
+            upward = vec3(0, 1, 0);
+            forward = vec3(0, 0, -1);
+            return;
+        }
+
+        forward = target != position ? normalize(target - position) : vec3(0, 0, -1);
+        right = cross(forward, up);
+        // Looking along up: any horizontal right will do
+        if (length(right) < 1e-6f)
+            right = cross(forward, std::abs(forward.z) < 0.9f ? vec3(0, 0, 1) : vec3(1, 0, 0));
+        right = normalize(right);
+        upward = cross(right, forward);
+    }
 };
 
 /**
- * Lights source
+ * Lights source.
+ * A point, unless given a shape: a rectangle or a sphere, whose soft shadows take several shadow rays.
  */
 class Light : public SceneObj {
 public:
+    enum Shape { POINT, RECTANGLE, SPHERE };
+
     vec3 diffuseColor;
     vec3 specularColor;
 
+    Shape shape = POINT;
+    vec3 edge1 = vec3(), edge2 = vec3();    // Sides of a rectangle, centred on the position
+    float radius = 0;                       // Of a sphere
+    int samples = 16;                       // Shadow rays at most per point lit by a rectangle or a sphere
+
     Light() {}
+
+    bool isArea() const { return shape != POINT; }
+
+    /**
+     * Point of the light for a sample, as seen from a point of the scene.
+     * A sphere is sampled on its disc facing the point, which is what the point sees of it.
+     *
+     * @param from Point lit
+     * @param u Sample, in [0, 1[
+     * @param v
+     * @return
+     */
+    vec3 samplePoint(const vec3 &from, float u, float v) const {
+        if (shape == RECTANGLE)
+            return position + edge1 * (u - 0.5f) + edge2 * (v - 0.5f);
+        if (shape == POINT)
+            return position;
+
+        vec3 axis = from - position;
+        float distance = length(axis);
+        axis = distance > 0 ? axis * (1.f / distance) : vec3(0, 0, 1);
+        vec3 a = normalize(cross(axis, std::abs(axis.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+        vec3 b = cross(axis, a);
+
+        float r = radius * std::sqrt(u);
+        float angle = 2 * (float) M_PI * v;
+        return position + a * (r * std::cos(angle)) + b * (r * std::sin(angle));
+    }
 };
 
 
 /**
- * Spheres
+ * Sphere as the scene stores it for the render path: plain data, intersected without virtual calls
  */
-class Sphere : public Renderable {
-public:
+struct SpherePrim {
+    vec3 position;
     double radius;
-
-    Sphere(const vec3 &pos, double radius) : Renderable(pos), radius(radius) {}
+    float radiusSquared;    // For the packet kernel
+    int obj;                // Index in Scene::objs
 
     /**
      * Try to intersect the ray with the shape, and return only the closest t solution.
@@ -93,7 +189,7 @@ public:
      * @param ray
      * @return t
      */
-    double intersect(Ray ray) override {
+    double intersect(const Ray &ray) const {
         vec3 diff = ray.origin - position;
 
         double b = 2*(dot(diff, normalize(ray.direction) ));
@@ -117,9 +213,9 @@ public:
         }
 
         // Check if it was a backface, if so, ignore
-        if(result<INFINITY){
+        if(result<INFINITY && !ray.backfaces){
             // Normal at point
-            vec3 np = getNormalAt(ray.origin + (float)result*ray.direction);
+            vec3 np = normalAt(ray.origin + (float)result*ray.direction);
             if( dot(normalize(np),normalize(ray.direction)) > 0 )
                 return INFINITY;
         }
@@ -128,40 +224,109 @@ public:
         return result;
     }
 
+    /**
+     * Single precision version of intersect(), for a normalized direction.
+     * The entering solution is the front face, the leaving one is only kept for rays asking for backfaces.
+     * The discriminant is taken from the distance between the centre and the ray, and the entering solution
+     * from the product of the roots, which both keep their precision for spheres far from the origin of the ray
+     * and for rays starting on the surface.
+     *
+     * @param ray
+     * @return t, INFINITY if missed
+     */
+    float intersectFast(const Ray &ray) const {
+        vec3 diff = ray.origin - position;
+        float b = glm::dot(diff, ray.direction);
+        float c = glm::dot(diff, diff) - radiusSquared;
+
+        vec3 closest = diff - ray.direction * b;
+        float delta = radiusSquared - glm::dot(closest, closest);
+        if (delta < 0)
+            return INFINITY;
+        float root = std::sqrt(delta);
+
+        // From outside or on the surface, towards the centre: entering
+        if (c >= 0 && b < 0)
+            return c / (root - b);
+
+        // From inside: leaving, a backface
+        float t = root - b;
+        return ray.backfaces && c < 0 && t > 0 ? t : INFINITY;
+    }
+
     /**
      * Get normal of the sphere in straight line with the given point.
      * @param point
      * @return
      */
-    vec3 getNormalAt(vec3 point) override {
+    vec3 normalAt(const vec3 &point) const {
         return normalize(point - position);
     }
 };
 
 
 /**
- * Infinite plane
+ * Spheres
  */
-class Plane : public Renderable {
+class Sphere : public Renderable {
 public:
-    vec3 normal;
+    double radius;
 
-    Plane() {}
+    Sphere(const vec3 &pos, double radius) : Renderable(pos), radius(radius) {}
+
+    double intersect(Ray ray) override {
+        return prim(-1).intersect(ray);
+    }
+
+    vec3 getNormalAt(vec3 point) override {
+        return prim(-1).normalAt(point);
+    }
+
+    bool getBounds(AABB &box) override {
+        float r = (float)radius;
+        box.pMin = position - vec3(r, r, r);
+        box.pMax = position + vec3(r, r, r);
+        box.padForRounding();
+        return true;
+    }
+
+    /**
+     * Plain copy of the shape for the render path
+     * @param obj Index of the sphere in Scene::objs
+     * @return
+     */
+    SpherePrim prim(int obj) const {
+        return {position, radius, (float)(radius * radius), obj};
+    }
+};
+
+
+/**
+ * Plane as the scene stores it for the render path
+ */
+struct PlanePrim {
+    vec3 position;
+    vec3 normal;        // As given, not normalized
+    int obj;            // Index in Scene::objs
+
+    // The plane as unitNormal . p = d, for intersectFast()
+    vec3 unitNormal;
+    float d;
 
     /**
      * Try to intersect the ray with the shape, and return only the closest t solution.
      * Ignore -t solutions.
-     * Ignore for backface
+     * Ignore for backface, unless the ray asks for them
      *
      * Returns INFINITY otherwise.
      *
      * @param ray
      * @return t
      */
-    double intersect(Ray ray) override {
+    double intersect(const Ray &ray) const {
         float denominator = dot(normal, normalize(-ray.direction) );
 
-        if (denominator > 0.000001f){
+        if (denominator > 0.000001f || (ray.backfaces && denominator < -0.000001f)){
             float t = dot( (ray.origin - position), normal) / denominator;
             if (t>0) return t;
         }
@@ -169,92 +334,1082 @@ public:
         return INFINITY;
     }
 
+    /**
+     * Single precision version of intersect(), for a normalized direction
+     * @param ray
+     * @return t, INFINITY if missed
+     */
+    float intersectFast(const Ray &ray) const {
+        float cosine = glm::dot(unitNormal, ray.direction);
+        float t = (d - glm::dot(unitNormal, ray.origin)) / cosine;
+
+        bool facing = cosine < -0.000001f || (ray.backfaces && cosine > 0.000001f);
+        return facing && t > 0 ? t : INFINITY;
+    }
+
     /**
      * Get normal of the plane, regardless of the point (same everywhere)
-     * @param point
      * @return
      */
-    vec3 getNormalAt(vec3 point) override {
+    vec3 normalAt() const {
         return normalize(normal);
     }
 };
 
 
 /**
- * Class that represent every triangle in a mesh
+ * Infinite plane
  */
-class Triangle : public Plane {
-    vec3 p1;
-    vec3 p2;
-    vec3 p3;
+class Plane : public Renderable {
 public:
-    Triangle(vec3 p1, vec3 p2, vec3 p3) {
-        this->p1 = p1;
-        this->p2 = p2;
-        this->p3 = p3;
+    vec3 normal;
+
+    Plane() {}
+
+    double intersect(Ray ray) override {
+        return prim(-1).intersect(ray);
+    }
 
-        normal = normalize(cross(p2-p1, p3-p1));
-        position = p1;
+    vec3 getNormalAt(vec3) override {
+        return prim(-1).normalAt();
     }
 
     /**
-     * Find intersection with the given ray.
-     * Return a t value only if inside the triangle
-     * Compute for backface culling
+     * Plain copy of the shape for the render path
+     * @param obj Index of the plane in Scene::objs
+     * @return
+     */
+    PlanePrim prim(int obj) const {
+        vec3 unitNormal = normalize(normal);
+        return {position, normal, obj, unitNormal, glm::dot(unitNormal, position)};
+    }
+};
+
+
+/**
+ * Object of a type unknown to the render path, intersected through its virtual interface
+ */
+struct ObjectPrim {
+    Renderable *object;
+    int obj;        // Index in Scene::objs
+
+    double intersect(const Ray &ray) const {
+        return object->intersect(ray);
+    }
+
+    double intersectFast(const Ray &ray) const {
+        return object->intersect(ray);
+    }
+};
+
+
+/**
+ * Triangles of a mesh, stored as a structure of arrays:
+ * the first vertex of each triangle and the two edges leaving it, one array per coordinate.
+ * The triangles stay where the OBJ file puts them, the mesh being placed in the scene by its instances.
+ */
+struct Mesh {
+    Buffer<float> p0[3];    // First vertex
+    Buffer<float> e1[3];    // Second vertex - first vertex
+    Buffer<float> e2[3];    // Third vertex - first vertex
+    Buffer<float> uvs[6];   // Texture coordinates of the three vertices, u then v, empty if the mesh has none
+    Buffer<float> normals[9];   // Normals of the three vertices, x y z each, empty if the mesh has none
+
+    // Over the triangles, built by buildBVH()
+    BVH bvh;
+    AABB bounds;
+
+    int size() const { return p0[0].size(); }
+
+    bool hasUVs() const { return uvs[0].size() > 0; }
+
+    bool hasNormals() const { return normals[0].size() > 0; }
+
+    void reserve(int triangles) {
+        for (int i = 0; i < 3; i++) {
+            p0[i].reserve(triangles);
+            e1[i].reserve(triangles);
+            e2[i].reserve(triangles);
+        }
+    }
+
+    void addTriangle(const vec3 &a, const vec3 &b, const vec3 &c) {
+        // The BVH doesn't cover the new triangle
+        if (!bvh.empty()) bvh = BVH();
+
+        for (int i = 0; i < 3; i++) {
+            p0[i].push_back(a[i]);
+            e1[i].push_back(b[i] - a[i]);
+            e2[i].push_back(c[i] - a[i]);
+        }
+    }
+
+    /**
+     * Texture coordinates of the last triangle added, to give to every triangle or none
+     * @param a
+     * @param b
+     * @param c
+     */
+    void addUVs(const vec2 &a, const vec2 &b, const vec2 &c) {
+        const vec2 *corners[3] = {&a, &b, &c};
+        for (int k = 0; k < 3; k++) {
+            uvs[2 * k].push_back(corners[k]->x);
+            uvs[2 * k + 1].push_back(corners[k]->y);
+        }
+    }
+
+    /**
+     * Vertex normals of the last triangle added, to give to every triangle or none
+     * @param a
+     * @param b
+     * @param c
+     */
+    void addNormals(const vec3 &a, const vec3 &b, const vec3 &c) {
+        const vec3 *corners[3] = {&a, &b, &c};
+        for (int k = 0; k < 3; k++) {
+            for (int i = 0; i < 3; i++)
+                normals[3 * k + i].push_back((*corners[k])[i]);
+        }
+    }
+
+    vec3 vertex(int tri) const { return vec3(p0[0][tri], p0[1][tri], p0[2][tri]); }
+    vec3 edge1(int tri) const { return vec3(e1[0][tri], e1[1][tri], e1[2][tri]); }
+    vec3 edge2(int tri) const { return vec3(e2[0][tri], e2[1][tri], e2[2][tri]); }
+
+    /**
+     * Face normal of a triangle, its vertices being counter-clockwise
+     * @param tri
+     * @return
+     */
+    vec3 getNormal(int tri) const {
+        return normalize(cross(edge1(tri), edge2(tri)));
+    }
+
+    /**
+     * Shading normal of a point of a triangle, interpolated between its vertex normals, the mesh having some.
+     * Falls back on the face normal where they cancel out.
      *
+     * @param tri
+     * @param u Barycentric coordinates of the point, weights of the second and third vertices
+     * @param v
+     * @return Normalized
+     */
+    vec3 normalAt(int tri, float u, float v) const {
+        vec3 a(normals[0][tri], normals[1][tri], normals[2][tri]);
+        vec3 b(normals[3][tri], normals[4][tri], normals[5][tri]);
+        vec3 c(normals[6][tri], normals[7][tri], normals[8][tri]);
+        vec3 n = a * (1 - u - v) + b * u + c * v;
+        return dot(n, n) > 0 ? normalize(n) : getNormal(tri);
+    }
+
+    /**
+     * Texture coordinates of a point of a triangle, the mesh having some
+     * @param tri
+     * @param u Barycentric coordinates of the point, weights of the second and third vertices
+     * @param v
+     * @return
+     */
+    vec2 uvAt(int tri, float u, float v) const {
+        vec2 a(uvs[0][tri], uvs[1][tri]), b(uvs[2][tri], uvs[3][tri]), c(uvs[4][tri], uvs[5][tri]);
+        return a + (b - a) * u + (c - a) * v;
+    }
+
+    /**
+     * Area of a triangle in texture coordinates, the mesh having some
+     * @param tri
+     * @return
+     */
+    float uvArea(int tri) const {
+        vec2 ab(uvs[2][tri] - uvs[0][tri], uvs[3][tri] - uvs[1][tri]);
+        vec2 ac(uvs[4][tri] - uvs[0][tri], uvs[5][tri] - uvs[1][tri]);
+        return 0.5f * std::abs(ab.x * ac.y - ab.y * ac.x);
+    }
+
+    double intersect(int tri, const Ray &ray) const {
+        float u, v;
+        return intersect(tri, ray, u, v);
+    }
+
+    /**
+     * Möller–Trumbore intersection, with backface culling unless the ray asks for backfaces.
+     * All the tests are folded into a single branch at the end.
+     *
+     * @param tri
      * @param ray
+     * @param u Gets the barycentric coordinates of the hit, weights of the second and third vertices
+     * @param v
+     * @return t, INFINITY if missed
+     */
+    double intersect(int tri, const Ray &ray, float &u, float &v) const {
+        vec3 e1 = edge1(tri), e2 = edge2(tri);
+
+        vec3 pvec = cross(ray.direction, e2);
+        float det = dot(e1, pvec);
+        float invDet = 1.f / det;
+
+        vec3 tvec = ray.origin - vertex(tri);
+        u = dot(tvec, pvec) * invDet;
+
+        vec3 qvec = cross(tvec, e1);
+        v = dot(ray.direction, qvec) * invDet;
+        float t = dot(e2, qvec) * invDet;
+
+        bool hit = ((det > 0) | (ray.backfaces & (det < 0))) & (u >= -TRIANGLE_EDGE_SLACK) & (v >= -TRIANGLE_EDGE_SLACK)
+                   & (u + v <= 1 + TRIANGLE_EDGE_SLACK) & (t > 0);
+        return hit ? t : INFINITY;
+    }
+
+    AABB getBounds(int tri) const {
+        AABB box;
+        vec3 a = vertex(tri);
+        box.expand(a);
+        box.expand(a + edge1(tri));
+        box.expand(a + edge2(tri));
+        box.padForRounding();
+        return box;
+    }
+
+    void buildBVH() {
+        vector<AABB> triBounds(size());
+        bounds = AABB();
+        for (int tri = 0; tri < size(); tri++) {
+            triBounds[tri] = getBounds(tri);
+            bounds.expand(triBounds[tri]);
+        }
+        bvh.build(triBounds);
+    }
+
+    /**
+     * Bytes held by the mesh, triangles and BVH
      * @return
      */
-    double intersect(Ray ray) override {
-        // Intersection with the general forming plane
-        // This enforce backface culling
-        double t = Plane::intersect(ray);
-        if(t == INFINITY)
-            return t;
-
-        ///// Barycentric method
-        // Finding the point
-        vec3 point = ray.origin + (float)t*ray.direction;
-
-        vec3 edge0 = p2-p1;
-        vec3 edge1 = p3-p2;
-        vec3 edge2 = p1-p3;
-
-        vec3 C0 = point - p1;
-        vec3 C1 = point - p2;
-        vec3 C2 = point - p3;
-
-        // Negative bias for clean edges and slight permission
-        float edgeBias = -0.000001f;
-
-        // Check if inside the triangle
-        if(
-                dot(normal, cross(edge0, C0)) > edgeBias
-                && dot(normal, cross(edge1, C1)) > edgeBias
-                && dot(normal, cross(edge2, C2)) > edgeBias
-                ){
-            return t;
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(Mesh);
+        for (int i = 0; i < 3; i++)
+            bytes += p0[i].memoryUsage() + e1[i].memoryUsage() + e2[i].memoryUsage();
+        for (int i = 0; i < 6; i++)
+            bytes += uvs[i].memoryUsage();
+        for (int i = 0; i < 9; i++)
+            bytes += normals[i].memoryUsage();
+        return bytes + bvh.memoryUsage();
+    }
+};
+
+
+/**
+ * A mesh placed in the scene, with its own transform and material.
+ * Rays are brought into the space of the mesh by the inverse transform, rather than the triangles into the scene,
+ * so every instance shares the triangles and the BVH of the mesh. Directions aren't normalized back:
+ * distances along a ray are the same in both spaces, and hits of different instances compare as they are.
+ */
+struct MeshInstance {
+    int mesh = 0;                   // Index in Scene::meshes
+    int material = 0;               // Index in Scene::materials
+
+    vec3 position = vec3();         // Translation, after the rotation and scale
+    mat3 linear = mat3(1);          // Rotation and scale
+    mat3 toObject = mat3(1);        // Inverse of linear
+    mat3 normalToWorld = mat3(1);   // Inverse transpose of linear
+    bool identity = true;           // The mesh is used where it is: rays don't need to be transformed
+
+    AABB bounds;                    // In the scene, set by updateBounds()
+
+    MeshInstance() {}
+    MeshInstance(int mesh, int material) : mesh(mesh), material(material) {}
+
+    /**
+     * Place the mesh: scaled and rotated by linear, then moved by position
+     * @param position
+     * @param linear
+     */
+    void setTransform(const vec3 &position, const mat3 &linear) {
+        this->position = position;
+        this->linear = linear;
+        toObject = inverse(linear);
+        normalToWorld = transpose(toObject);
+        identity = position == vec3() && linear[0] == vec3(1, 0, 0) && linear[1] == vec3(0, 1, 0)
+                   && linear[2] == vec3(0, 0, 1);
+    }
+
+    /**
+     * Ray in the space of the mesh
+     * @param ray
+     * @return
+     */
+    Ray toObjectRay(const Ray &ray) const {
+        if (identity) return ray;
+        Ray local(toObject * (ray.origin - position), toObject * ray.direction);
+        local.backfaces = ray.backfaces;
+        return local;
+    }
+
+    /**
+     * Packet in the space of the mesh, the rays still sharing their origin
+     * @param rays
+     * @return
+     */
+    RayPacket toObjectPacket(const RayPacket &rays) const {
+        float d[3][RayPacket::SIZE];
+        rays.dx.store(d[0]);
+        rays.dy.store(d[1]);
+        rays.dz.store(d[2]);
+
+        vec3 directions[RayPacket::SIZE];
+        for (int l = 0; l < RayPacket::SIZE; l++)
+            directions[l] = toObject * vec3(d[0][l], d[1][l], d[2][l]);
+
+        // Active lanes are always the first ones
+        RayPacket local(toObject * (rays.origin - position), directions, RayPacket::SIZE);
+        local.active = rays.active;
+        return local;
+    }
+
+    vec3 normalToScene(const vec3 &normal) const {
+        return identity ? normal : normalize(normalToWorld * normal);
+    }
+
+    /**
+     * Box of the instance, around the transformed corners of the box of its mesh
+     * @param meshBounds
+     */
+    void updateBounds(const AABB &meshBounds) {
+        if (identity || !meshBounds.isValid()) {
+            bounds = meshBounds;
+            return;
         }
-        return INFINITY;
+
+        bounds = AABB();
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 p((corner & 1 ? meshBounds.pMax : meshBounds.pMin).x,
+                   (corner & 2 ? meshBounds.pMax : meshBounds.pMin).y,
+                   (corner & 4 ? meshBounds.pMax : meshBounds.pMin).z);
+            bounds.expand(linear * p + position);
+        }
+        bounds.padForRounding();
     }
 };
 
 
 /**
- * Holding mesh informations
+ * Closest hit of a ray: the type of the primitive, and its index in the array of its type.
+ * All the intersection tests give, kept small since they copy it around: the point, its normals and the rest
+ * of what shading needs are only worked out for the closest hit, by Scene::surfaceAt.
  */
-struct Mesh {
-    vector<Triangle *> triangles;
+struct Hit {
+    enum Type { NONE, SPHERE, PLANE, TRIANGLE, OTHER };
+
+    float t = INFINITY;
+    Type type = NONE;
+    int index = -1;     // In Scene::spheres, planes or others, or the triangle in its mesh
+    int mesh = -1;      // Instance of the triangle, in Scene::instances
+    float u = 0, v = 0; // Barycentric coordinates of a triangle hit, weights of its second and third vertices
+};
+
+
+/**
+ * Point of a surface hit, and its normals
+ */
+struct SurfacePoint {
+    vec3 point;
+    vec3 normal;            // Of the geometry, as the object gives it: not always normalized
+    vec3 unitNormal;        // normal, normalized
+    vec3 shadingNormal;     // Interpolated between the vertex normals of smooth meshes, unitNormal otherwise
+};
+
+
+/**
+ * Collects the hits that can still win a closest hit query.
+ *
+ * A linear scan over the scene keeps its running minimum in a float, so two hits
+ * less than a float step apart resolve depending on the order they are tested in.
+ * Every hit under two float steps past the best one is kept, and replayed in scene order
+ * (objs, then the triangles of each mesh instance), so the result is exactly the one of the linear scan
+ * whatever order the BVH visits them in.
+ */
+struct HitCandidates {
+    static const int MAX = 32;
+    Hit hits[MAX];
+    double t[MAX];
+    int size = 0;
+
+    double best = INFINITY;
+    float bound = INFINITY;     // Hits at or past this distance can not win anymore
+
+    void add(const Hit &hit, double tk) {
+        if (!(tk > 0 && tk < bound))
+            return;
+
+        if (tk < best) {
+            best = tk;
+            bound = nextafterf(nextafterf((float)tk, INFINITY), INFINITY);
+
+            // Drop the candidates now out of reach
+            int kept = 0;
+            for (int i = 0; i < size; i++) {
+                if (t[i] < bound) {
+                    hits[kept] = hits[i];
+                    t[kept] = t[i];
+                    kept++;
+                }
+            }
+            size = kept;
+        }
+
+        if (size < MAX) {
+            hits[size] = hit;
+            t[size] = tk;
+            size++;
+            return;
+        }
+
+        // Full, of coplanar or coincident prims: the farthest candidate makes room for a closer hit,
+        // so the best one is always kept
+        int farthest = 0;
+        for (int i = 1; i < size; i++) {
+            if (t[i] > t[farthest])
+                farthest = i;
+        }
+        if (tk < t[farthest]) {
+            hits[farthest] = hit;
+            t[farthest] = tk;
+        }
+    }
+
+    /**
+     * Replay the candidates in scene order, the same way the linear scan does
+     * @param order Rank of a hit in the scene order, order(hit)
+     * @return The closest hit, with t = INFINITY if none
+     */
+    template<typename Order>
+    Hit resolve(Order &&order) const {
+        Hit closest;
+        long long keys[MAX];
+        for (int i = 0; i < size; i++)
+            keys[i] = order(hits[i]);
+
+        long long previous = -1;
+        for (int n = 0; n < size; n++) {
+            // Next candidate in scene order
+            int next = -1;
+            for (int i = 0; i < size; i++) {
+                if (keys[i] > previous && (next < 0 || keys[i] < keys[next]))
+                    next = i;
+            }
+            previous = keys[next];
+
+            if (t[next] < closest.t) {
+                closest = hits[next];
+                closest.t = t[next];
+            }
+        }
+        return closest;
+    }
 };
 
 
 /**
- * Scene containing all objects
+ * Scene containing all objects.
+ * The objects and lights are created by the scene, in arenas holding each type side by side,
+ * and destroyed with it or by clear().
+ *
+ * Once complete, buildBVH() compiles the objects into flat arrays per type, so that the render path
+ * intersects them with loops specialised for each type, rather than through the virtual interface.
  */
 struct Scene {
     Camera cam = Camera(vec3());
     vector<Light *> lights;
     vector<Renderable *> objs;
+    vector<Mesh> meshes;            // Loaded once per OBJ file
+    vector<MeshInstance> instances; // Placements of the meshes, each with its transform and material
+    vector<Material> materials;     // Of the instances
+
+    // Of the materials, kept from one scene to the next with the tiles it holds, created by the first texture
+    shared_ptr<TextureCache> textures;
+
+    // Built by buildBVH(): the objects of objs sorted by type.
+    // The top level BVH holds the spheres, then the bounded objects of other types from othersStart,
+    // then the mesh instances from instancesStart, each one over the BVH of its mesh.
+    // The prims of each leaf are sorted, so each type comes in a run.
+    BVH bvh;
+    vector<SpherePrim> spheres;
+    vector<PlanePrim> planes;       // Unbounded, tested by every ray
+    vector<ObjectPrim> others;      // Types unknown to the render path
+    vector<int> unbounded;          // Indices in others of the ones without bounds
+    int othersStart = 0, instancesStart = 0;
+    vector<AABB> primBoxes;         // Of the prims of the BVH, invalid for the unbounded ones
+    float builtCost = 0;            // Of the BVH as built, before being refitted
+
+    // Moving parts, for a sequence of frames
+    Animation animation;
+
+    // Intersect spheres and planes in single precision with their precomputed constants,
+    // rather than with the double precision math of the scene objects
+    bool fastIntersection = false;
+
+    Scene() {}
+
+    // Objects point into the arenas of the scene
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+    Scene(Scene &&) = default;
+
+    /**
+     * Create an object in the scene, added to objs or lights according to its type
+     * @param args Arguments of the constructor
+     * @return The object, owned by the scene
+     */
+    template<typename T, typename... Args>
+    T *create(Args &&... args) {
+        T *object = arenaOf((T *) nullptr).create(std::forward<Args>(args)...);
+        add(object);
+        return object;
+    }
+
+    /**
+     * Remove everything, to load another scene in its place.
+     * The memory of the objects is kept, loading a scene of the same size allocates none,
+     * and so are the textures with the tiles in their cache.
+     */
+    void clear() {
+        cam = Camera(vec3());
+        lights.clear();
+        objs.clear();
+        meshes.clear();
+        instances.clear();
+        materials.clear();
+        bvh = BVH();
+        spheres.clear();
+        planes.clear();
+        others.clear();
+        unbounded.clear();
+        primBoxes.clear();
+        animation.clear();
+
+        sphereArena.clear();
+        planeArena.clear();
+        lightArena.clear();
+    }
+
+    /**
+     * Sort the objects by type into their arrays, build the BVH of each mesh still without one,
+     * and the top level one over the bounded objects and the mesh instances.
+     * Has to be called again whenever the scene changes.
+     */
+    void buildBVH() {
+        spheres.clear();
+        planes.clear();
+        others.clear();
+        unbounded.clear();
+
+        for (int k = 0; k < objs.size(); k++) {
+            if (Sphere *sphere = dynamic_cast<Sphere *>(objs[k]))
+                spheres.push_back(sphere->prim(k));
+            else if (Plane *plane = dynamic_cast<Plane *>(objs[k]))
+                planes.push_back(plane->prim(k));
+            else
+                others.push_back({objs[k], k});
+        }
+        othersStart = spheres.size();
+        instancesStart = othersStart + others.size();
+
+        for (int m = 0; m < meshes.size(); m++) {
+            // Meshes read from their cache file come with their BVH
+            if (meshes[m].bvh.empty())
+                meshes[m].buildBVH();
+        }
+        for (MeshInstance &instance : instances)
+            instance.updateBounds(meshes[instance.mesh].bounds);
+
+        primBoxes = primBounds();
+        for (int o = 0; o < others.size(); o++) {
+            if (!primBoxes[othersStart + o].isValid())
+                unbounded.push_back(o);
+        }
+
+        bvh.build(primBoxes);
+        builtCost = bvh.cost();
+    }
+
+    /**
+     * Update the arrays and the BVH after objects or instances moved, the objects of the scene staying the same.
+     * The BVH is only refitted, unless it got twice as costly as when it was built.
+     */
+    void refitBVH() {
+        for (SpherePrim &sphere : spheres)
+            sphere = static_cast<Sphere *>(objs[sphere.obj])->prim(sphere.obj);
+        for (PlanePrim &plane : planes)
+            plane = static_cast<Plane *>(objs[plane.obj])->prim(plane.obj);
+        for (MeshInstance &instance : instances)
+            instance.updateBounds(meshes[instance.mesh].bounds);
+
+        primBoxes = primBounds();
+        bvh.refit(primBoxes);
+        if (bvh.cost() > 2 * builtCost)
+            buildBVH();
+    }
+
+    /**
+     * Move the animated camera, objects, lights and mesh instances to where they are at a frame, and refit the BVH
+     * @param frame
+     */
+    void setFrame(float frame) {
+        if (animation.empty()) return;
+
+        if (!animation.camera.empty())
+            cam.position = animation.camera.at(frame);
+        for (const auto &object : animation.objects)
+            objs[object.first]->position = object.second.at(frame);
+        for (const auto &light : animation.lights)
+            lights[light.first]->position = light.second.at(frame);
+        for (const auto &instance : animation.instances)
+            instances[instance.first].setTransform(instance.second.at(frame), instances[instance.first].linear);
+
+        refitBVH();
+    }
+
+    /**
+     * Find the closest object in front of the ray
+     * @param ray
+     * @return The closest hit, with t = INFINITY if none
+     */
+    Hit closestHit(const Ray &ray) const {
+        return fastIntersection ? closestHitWith<true>(ray) : closestHitWith<false>(ray);
+    }
+
+    /**
+     * Packet version of closestHit, for rays sharing their origin.
+     * Distances are computed in single precision, so they can differ slightly from closestHit.
+     *
+     * @param rays
+     * @param hits Closest hit of each lane
+     */
+    void closestHitPacket(const RayPacket &rays, Hit hits[]) const {
+        vfloat tHit(INFINITY);
+        vfloat uHit(0.f), vHit(0.f);    // Barycentric coordinates of the triangle hits
+        for (int l = 0; l < RayPacket::SIZE; l++)
+            hits[l] = Hit();
+
+        // Record the new closest hits of the lanes
+        auto record = [&](vmask hitLanes, const Hit &hit) {
+            int lanes = hitLanes.bits();
+            for (int l = 0; lanes; l++, lanes >>= 1) {
+                if (lanes & 1)
+                    hits[l] = hit;
+            }
+        };
+
+        int packetTests = planes.size() + unbounded.size();
+        for (int p = 0; p < planes.size(); p++)
+            record(intersectPlanePacket(planes[p].position, planes[p].normal, rays, tHit), primHit(Hit::PLANE, p));
+        for (int o : unbounded)
+            record(intersectOtherPacket(others[o], rays, tHit), primHit(Hit::OTHER, o));
+
+        bvh.traversePacket(rays, tHit, [&](int k, vfloat &tMax) {
+            if (k < othersStart) {
+                const SpherePrim &sphere = spheres[k];
+                record(intersectSpherePacket(sphere.position, sphere.radiusSquared, rays, tHit), primHit(Hit::SPHERE, k));
+                packetTests++;
+            } else if (k < instancesStart) {
+                record(intersectOtherPacket(others[k - othersStart], rays, tHit), primHit(Hit::OTHER, k - othersStart));
+                packetTests++;
+            } else {
+                int i = k - instancesStart;
+                const MeshInstance &instance = instances[i];
+                const Mesh &mesh = meshes[instance.mesh];
+                RayPacket local = instance.identity ? rays : instance.toObjectPacket(rays);
+
+                mesh.bvh.traversePacket(local, tHit, [&](int tri, vfloat &meshTMax) {
+                    vmask hitLanes = intersectTrianglePacket(mesh.vertex(tri), mesh.edge1(tri), mesh.edge2(tri), local, tHit,
+                                                             uHit, vHit);
+                    record(hitLanes, triangleHit(i, tri));
+                    packetTests++;
+                    meshTMax = tHit;
+                });
+            }
+            tMax = tHit;
+        });
+
+        if (RayCounters::enabled())
+            RayCounters::local().packetTests += packetTests;
+
+        float t[RayPacket::SIZE], u[RayPacket::SIZE], v[RayPacket::SIZE];
+        tHit.store(t);
+        uHit.store(u);
+        vHit.store(v);
+        for (int l = 0; l < RayPacket::SIZE; l++) {
+            hits[l].t = t[l];
+            hits[l].u = u[l];
+            hits[l].v = v[l];
+        }
+    }
+
+    /**
+     * Check if any object intersects the ray before the given distance, stopping at the first one found.
+     * The last occluder, if given, is tested first: the points around a shadowed one are usually shadowed by it too.
+     *
+     * @param shadowRay Normalized direction
+     * @param maxDistance Distance to the light
+     * @param lastOccluder Updated with the object found, if any
+     * @return
+     */
+    bool isOccluded(const Ray &shadowRay, float maxDistance, Hit *lastOccluder = nullptr) const {
+        return fastIntersection ? isOccludedWith<true>(shadowRay, maxDistance, lastOccluder)
+                                : isOccludedWith<false>(shadowRay, maxDistance, lastOccluder);
+    }
+
+    const Material &materialOf(const Hit &hit) const {
+        return hit.type == Hit::TRIANGLE ? materials[instances[hit.mesh].material] : objs[objectIndex(hit)]->material;
+    }
+
+    vec3 getNormalAt(const Hit &hit, const vec3 &point) const {
+        switch (hit.type) {
+            case Hit::SPHERE:
+                return spheres[hit.index].normalAt(point);
+            case Hit::PLANE:
+                return planes[hit.index].normalAt();
+            case Hit::TRIANGLE: {
+                const MeshInstance &instance = instances[hit.mesh];
+                return instance.normalToScene(meshes[instance.mesh].getNormal(hit.index));
+            }
+            default:
+                return others[hit.index].object->getNormalAt(point);
+        }
+    }
+
+    /**
+     * Work out the point of the closest hit of a ray, and its normals
+     * @param ray
+     * @param hit Not missed
+     * @return
+     */
+    SurfacePoint surfaceAt(const Ray &ray, const Hit &hit) const {
+        SurfacePoint surface;
+        surface.point = ray.origin + (ray.direction * hit.t);
+        surface.normal = getNormalAt(hit, surface.point);
+        surface.unitNormal = normalize(surface.normal);
+        surface.shadingNormal = surface.unitNormal;
+
+        if (hit.type == Hit::TRIANGLE) {
+            const MeshInstance &instance = instances[hit.mesh];
+            const Mesh &mesh = meshes[instance.mesh];
+            if (mesh.hasNormals()) {
+                // Vertex normals are on the side of the face, whichever way the file has them
+                vec3 smooth = instance.normalToScene(mesh.normalAt(hit.index, hit.u, hit.v));
+                surface.shadingNormal = dot(smooth, surface.unitNormal) < 0 ? -smooth : smooth;
+            }
+        }
+        return surface;
+    }
+
+    /**
+     * Object of the scene hit, mesh instances counting as one object after those of objs
+     * @param hit
+     * @return -1 for the background
+     */
+    int objectIndex(const Hit &hit) const {
+        switch (hit.type) {
+            case Hit::SPHERE:
+                return spheres[hit.index].obj;
+            case Hit::PLANE:
+                return planes[hit.index].obj;
+            case Hit::TRIANGLE:
+                return objs.size() + hit.mesh;
+            case Hit::OTHER:
+                return others[hit.index].obj;
+            default:
+                return -1;
+        }
+    }
+
+private:
+    Arena<Sphere> sphereArena;
+    Arena<Plane> planeArena;
+    Arena<Light> lightArena;
+
+    /**
+     * Boxes of the spheres, other objects and mesh instances, in the order of the BVH.
+     * Unbounded objects get an invalid box.
+     * @return
+     */
+    vector<AABB> primBounds() const {
+        vector<AABB> bounds(instancesStart + instances.size());
+        for (int s = 0; s < spheres.size(); s++)
+            objs[spheres[s].obj]->getBounds(bounds[s]);
+
+        for (int o = 0; o < others.size(); o++) {
+            if (!others[o].object->getBounds(bounds[othersStart + o]))
+                bounds[othersStart + o] = AABB();
+        }
+
+        for (int i = 0; i < instances.size(); i++)
+            bounds[instancesStart + i] = instances[i].bounds;
+        return bounds;
+    }
+
+    Arena<Sphere> &arenaOf(Sphere *) { return sphereArena; }
+    Arena<Plane> &arenaOf(Plane *) { return planeArena; }
+    Arena<Light> &arenaOf(Light *) { return lightArena; }
+
+    void add(Renderable *object) { objs.push_back(object); }
+    void add(Light *light) { lights.push_back(light); }
+
+    template<bool FAST>
+    Hit closestHitWith(const Ray &ray) const {
+        HitCandidates candidates;
+        int objectTests = planes.size() + unbounded.size(), triangleTests = 0;
+
+        for (int p = 0; p < planes.size(); p++)
+            candidates.add(primHit(Hit::PLANE, p), intersectPrim<FAST>(planes[p], ray));
+        for (int o : unbounded)
+            candidates.add(primHit(Hit::OTHER, o), intersectPrim<FAST>(others[o], ray));
+
+        bvh.traverseLeaves(ray, candidates.bound, [&](const int *leaf, int count, float &tMax) {
+            const int *end = leaf + count;
+            const int *objects = leaf;
+
+            leaf = intersectRun<FAST>(spheres, Hit::SPHERE, 0, leaf, end, ray, candidates);
+            leaf = intersectRun<FAST>(others, Hit::OTHER, othersStart, leaf, end, ray, candidates);
+            objectTests += leaf - objects;
+
+            // Down into the BVH of the meshes, in the space of each instance
+            for (; leaf < end; leaf++) {
+                int i = *leaf - instancesStart;
+                const Mesh &mesh = meshes[instances[i].mesh];
+                Ray local = instances[i].toObjectRay(ray);
+
+                mesh.bvh.traverse(local, tMax, [&](int tri, float &meshTMax) {
+                    float u, v;
+                    double t = mesh.intersect(tri, local, u, v);
+                    candidates.add(triangleHit(i, tri, u, v), t);
+                    triangleTests++;
+                    meshTMax = candidates.bound;
+                    return false;
+                });
+            }
+
+            tMax = candidates.bound;
+            return false;
+        });
+
+        if (RayCounters::enabled()) {
+            RayCounters &counters = RayCounters::local();
+            counters.objectTests += objectTests;
+            counters.triangleTests += triangleTests;
+        }
+        return candidates.resolve([&](const Hit &hit) { return sceneOrder(hit); });
+    }
+
+    template<bool FAST>
+    bool isOccludedWith(const Ray &shadowRay, float maxDistance, Hit *lastOccluder) const {
+        if (lastOccluder && occludes<FAST>(*lastOccluder, shadowRay, maxDistance)) {
+            if (RayCounters::enabled()) {
+                RayCounters &counters = RayCounters::local();
+                counters.shadowRays++;
+                counters.occluderCacheHits++;
+                counters.occluded++;
+                (lastOccluder->type == Hit::TRIANGLE ? counters.triangleTests : counters.objectTests)++;
+            }
+            return true;
+        }
+
+        Hit occluder;
+        int objectTests = lastOccluder && lastOccluder->type != Hit::NONE && lastOccluder->type != Hit::TRIANGLE;
+        int triangleTests = lastOccluder && lastOccluder->type == Hit::TRIANGLE;
+
+        for (int p = 0; p < planes.size() && occluder.type == Hit::NONE; p++) {
+            objectTests++;
+            if (intersectPrim<FAST>(planes[p], shadowRay) < maxDistance)
+                occluder = primHit(Hit::PLANE, p);
+        }
+        for (int u = 0; u < unbounded.size() && occluder.type == Hit::NONE; u++) {
+            objectTests++;
+            if (intersectPrim<FAST>(others[unbounded[u]], shadowRay) < maxDistance)
+                occluder = primHit(Hit::OTHER, unbounded[u]);
+        }
+
+        if (occluder.type == Hit::NONE) {
+            bvh.traverseLeaves(shadowRay, maxDistance, [&](const int *leaf, int count, float &) {
+                const int *end = leaf + count;
+                const int *objects = leaf;
+
+                leaf = occluderInRun<FAST>(spheres, Hit::SPHERE, 0, leaf, end, shadowRay, maxDistance, occluder);
+                if (occluder.type == Hit::NONE)
+                    leaf = occluderInRun<FAST>(others, Hit::OTHER, othersStart, leaf, end, shadowRay, maxDistance, occluder);
+                objectTests += leaf - objects + (occluder.type != Hit::NONE);
+
+                for (; leaf < end && occluder.type == Hit::NONE; leaf++) {
+                    int i = *leaf - instancesStart;
+                    const Mesh &mesh = meshes[instances[i].mesh];
+                    Ray local = instances[i].toObjectRay(shadowRay);
+                    mesh.bvh.traverse(local, maxDistance, [&](int tri, float &) {
+                        triangleTests++;
+                        if (mesh.intersect(tri, local) < maxDistance)
+                            occluder = triangleHit(i, tri);
+                        return occluder.type != Hit::NONE;
+                    });
+                }
+                return occluder.type != Hit::NONE;
+            });
+        }
+
+        bool found = occluder.type != Hit::NONE;
+        if (RayCounters::enabled()) {
+            RayCounters &counters = RayCounters::local();
+            counters.shadowRays++;
+            counters.occluded += found;
+            counters.objectTests += objectTests;
+            counters.triangleTests += triangleTests;
+        }
+        if (found && lastOccluder)
+            *lastOccluder = occluder;
+        return found;
+    }
+
+    /**
+     * Intersect a prim with the math of the mode
+     * @param prim
+     * @param ray
+     * @return t, INFINITY if missed
+     */
+    template<bool FAST, typename Prim>
+    static double intersectPrim(const Prim &prim, const Ray &ray) {
+        return FAST ? prim.intersectFast(ray) : prim.intersect(ray);
+    }
+
+    /**
+     * Intersect the leading run of a leaf made of prims of one type, [first, first + prims.size()[
+     * @param prims Array of the type
+     * @param type
+     * @param first BVH prim of prims[0]
+     * @param leaf
+     * @param end
+     * @param ray
+     * @param candidates
+     * @return Start of the next run
+     */
+    template<bool FAST, typename Prim>
+    static const int *intersectRun(const vector<Prim> &prims, Hit::Type type, int first, const int *leaf, const int *end,
+                                   const Ray &ray, HitCandidates &candidates) {
+        int last = first + (int) prims.size();
+        for (; leaf < end && *leaf < last; leaf++)
+            candidates.add(primHit(type, *leaf - first), intersectPrim<FAST>(prims[*leaf - first], ray));
+        return leaf;
+    }
+
+    /**
+     * Any hit version of intersectRun, stopping at the first prim closer than maxDistance
+     * @param occluder Set to the prim found, if any
+     * @return Start of the next run, or the prim found
+     */
+    template<bool FAST, typename Prim>
+    static const int *occluderInRun(const vector<Prim> &prims, Hit::Type type, int first, const int *leaf, const int *end,
+                                    const Ray &ray, float maxDistance, Hit &occluder) {
+        int last = first + (int) prims.size();
+        for (; leaf < end && *leaf < last; leaf++) {
+            if (intersectPrim<FAST>(prims[*leaf - first], ray) < maxDistance) {
+                occluder = primHit(type, *leaf - first);
+                break;
+            }
+        }
+        return leaf;
+    }
+
+    /**
+     * Rank of a hit in the order of a linear scan: objs, then the triangles of each mesh instance
+     * @param hit
+     * @return
+     */
+    long long sceneOrder(const Hit &hit) const {
+        return hit.type == Hit::TRIANGLE ? ((long long) (hit.mesh + 1) << 32) | hit.index : objectIndex(hit);
+    }
+
+    /**
+     * Check a single primitive against a shadow ray, the same way the walk of the BVH would.
+     * Its box has to be pierced too: a hit the rounding places outside of the box is one the BVH never reaches,
+     * and taking it here would make the shadow depend on the pixels shaded before.
+     *
+     * @param hit
+     * @param ray
+     * @param maxDistance
+     * @return false if missed, or if the hit references nothing
+     */
+    template<bool FAST>
+    bool occludes(const Hit &hit, const Ray &ray, float maxDistance) const {
+        float tNear;
+        switch (hit.type) {
+            case Hit::SPHERE:
+                return hit.index < spheres.size() && primBoxes[hit.index].intersect(ray.origin, ray.invDirection, maxDistance, tNear)
+                       && intersectPrim<FAST>(spheres[hit.index], ray) < maxDistance;
+            case Hit::PLANE:
+                return hit.index < planes.size() && intersectPrim<FAST>(planes[hit.index], ray) < maxDistance;
+            case Hit::TRIANGLE: {
+                if (hit.mesh >= instances.size()) return false;
+                const MeshInstance &instance = instances[hit.mesh];
+                const Mesh &mesh = meshes[instance.mesh];
+                if (hit.index >= mesh.size() || !instance.bounds.intersect(ray.origin, ray.invDirection, maxDistance, tNear))
+                    return false;
+
+                Ray local = instance.toObjectRay(ray);
+                return mesh.getBounds(hit.index).intersect(local.origin, local.invDirection, maxDistance, tNear)
+                       && mesh.intersect(hit.index, local) < maxDistance;
+            }
+            case Hit::OTHER: {
+                if (hit.index >= others.size()) return false;
+                const AABB &box = primBoxes[othersStart + hit.index];
+                if (box.isValid() && !box.intersect(ray.origin, ray.invDirection, maxDistance, tNear))
+                    return false;
+                return others[hit.index].intersect(ray) < maxDistance;
+            }
+            default:
+                return false;
+        }
+    }
+
+    static Hit primHit(Hit::Type type, int index) {
+        Hit hit;
+        hit.type = type;
+        hit.index = index;
+        return hit;
+    }
+
+    static Hit triangleHit(int instance, int tri, float u = 0, float v = 0) {
+        Hit hit;
+        hit.type = Hit::TRIANGLE;
+        hit.index = tri;
+        hit.mesh = instance;
+        hit.u = u;
+        hit.v = v;
+        return hit;
+    }
+
+    /**
+     * Packet against an object of a type unknown to the kernels, one ray at a time through its virtual interface
+     * @param other
+     * @param rays
+     * @param tHit Updated with the new hits
+     * @return Lanes with a new closest hit
+     */
+    static vmask intersectOtherPacket(const ObjectPrim &other, const RayPacket &rays, vfloat &tHit) {
+        float d[3][RayPacket::SIZE], t[RayPacket::SIZE];
+        rays.dx.store(d[0]);
+        rays.dy.store(d[1]);
+        rays.dz.store(d[2]);
+        tHit.store(t);
+
+        int active = rays.active.bits();
+        for (int l = 0; l < RayPacket::SIZE; l++) {
+            if (!(active & 1 << l)) continue;
+
+            double tl = other.intersect(Ray(rays.origin, vec3(d[0][l], d[1][l], d[2][l])));
+            if (tl > 0 && tl < t[l])
+                t[l] = tl;
+        }
+
+        vfloat tNew = vfloat::load(t);
+        vmask hit = tNew < tHit;
+        tHit = tNew;
+        return hit;
+    }
 };
 
 
@@ -1,313 +1,467 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <cmath>
 #include <CImg.h>
 #include "glm.hpp"
-#include "OBJloader.h"
 #include "NeededMath.h"
 #include "geometry.h"
+#include "Renderer.h"
+#include "Options.h"
+#include "SceneLoader.h"
+#include "Stats.h"
+#include "TiledOutput.h"
+#include "Preview.h"
+#include "Distributed.h"
 
 using namespace std;
 using namespace cimg_library;
 using namespace glm;
 
 // Signatures
-void loadScene(ifstream &file, Scene &scene);
+bool renderSceneFile(const string &filename, const Options &options, Scene &scene, OBJCache &objCache, SceneReport &report);
 
-vec3 readVec3(ifstream &file);
+bool renderTiledFile(Renderer &renderer, const string &output, const string &sceneFile, const Options &options,
+                     int threads, PhaseTimes &times, RenderStats &stats, int frame = -1);
+
+bool renderSequence(Renderer &renderer, const string &output, const string &sceneFile, const Options &options,
+                    int threads, SceneReport &report);
+
+string renderKey(const Renderer &renderer, const string &sceneFile, const Options &options, int frame);
+
+bool comparePackets(Renderer &renderer, const CImg<float> &reference, int threads);
+
+bool compareFastIntersection(Renderer &renderer, const CImg<float> &reference, double referenceSeconds, int threads);
+
+bool compareRenders(const CImg<float> &reference, const CImg<float> &other, const string &label);
 
 
 // Main
-int main() {
+int main(int argc, char **argv) {
+    Options options;
+
+    if (argc > 1) {
+        if (!parseArguments(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    } else {
+        // Ask the user for a scene file filename to parse
+        string filename;
+        cout << "Please enter a filename of a scenefile to load:" << endl;
+        cin >> filename;
+        options.scenes.push_back(filename);
+    }
+
+#if cimg_display == 0
+    // Built without display support
+    options.display = false;
+    if (options.interactive) {
+        cerr << "Built without display support, no interactive mode" << endl;
+        return 1;
+    }
+#endif
+
+    // Count the rays only when asked, it costs a little
+    RayCounters::enabled() = options.stats || !options.statsJSON.empty();
+
+    // Render the scenes one after the other in the same scene, loading each OBJ only once
     Scene scene;
+    OBJCache objCache;
+    vector<SceneReport> reports;
+    bool success = true;
+    for (const string &filename : options.scenes) {
+        SceneReport report;
+        success &= renderSceneFile(filename, options, scene, objCache, report);
+        if (options.stats)
+            report.print(cout);
+        reports.push_back(report);
+    }
 
-    ifstream inFile;
-    string filename;
+    if (!options.statsJSON.empty() && !SceneReport::writeJSON(options.statsJSON, reports)) {
+        cerr << "Unable to write " << options.statsJSON << endl;
+        success = false;
+    }
+
+    // End process
+    return success ? 0 : 1;
+}
 
-    // Ask the user for a scene file filename to parse
-    cout << "Please enter a filename of a scenefile to load:" << endl;
-    cin >> filename;
 
-    // Opening the file
-    inFile.open(filename);
-    if (!inFile) {
-        cerr << "Unable to open file " << filename;
-        exit(1);   // call system to stop
+/**
+ * Load, render and save a single scene file
+ * @param filename
+ * @param options
+ * @param scene Cleared, then filled with the scene of the file
+ * @param objCache
+ * @param report Gets the time of each phase, and the counters of the render
+ * @return false if the scene file couldn't be loaded or the render saved
+ */
+bool renderSceneFile(const string &filename, const Options &options, Scene &scene, OBJCache &objCache, SceneReport &report) {
+    PhaseTimes &times = report.times;
+    report.scene = filename;
+
+    // Create scene, in place of the previous one, the time spent on the OBJ files going to phases of their own
+    auto loadStart = chrono::steady_clock::now();
+    PhaseTimes meshTimes;
+    scene.clear();
+    bool loaded = loadScene(filename, scene, objCache, options, meshTimes, report.sceneBytes);
+    times.add("scene file", chrono::duration<double>(chrono::steady_clock::now() - loadStart).count() - meshTimes.total());
+    for (const auto &phase : meshTimes.phases)
+        times.add(phase.first, phase.second);
+    if (!loaded) {
+        cerr << "Unable to load the scene " << filename << endl;
+        return false;
     }
 
-    // Create scene
-    loadScene(inFile, scene);
-    inFile.close();
-    cout << "Scene successfully loaded." << endl;
-
-    // Set const for shooting ray
-    const float tanHalf = tan(scene.cam.fov / 2);
-    const int HEIGHT = tan(scene.cam.fov / 2) * 2 *
-                       scene.cam.focalLength;   // Here FOV has been loaded and converted to radians already.
-    const int WIDTH = scene.cam.aspectRatio * HEIGHT;
-
-
-    // Creates an image with three channels and sets it to black
-    CImg<float> image(WIDTH, HEIGHT, 1, 3, 0);
-
-    // Shoot rays
-    for (int i = -WIDTH / 2; i < WIDTH / 2; i++) {
-        // Current pixel x, calculated from ray.x coordinate (i)
-        int imgX = i + WIDTH / 2;
-
-        for (int j = HEIGHT / 2; j > -HEIGHT / 2; j--) {
-            // Current pixel y, calculated from ray.y coordinate (j)
-            int imgY = -j + HEIGHT / 2;
-            double t;
-            vec3 pixelColor = vec3();
-
-            // Create ray for current pixel
-            Ray ray = Ray(scene.cam.position, normalize(vec3(i, j, -scene.cam.focalLength)) );
-
-            // Check intersection with each objs
-            float closestScalar = INFINITY;
-            Renderable *closestObj;
-            for (int k = 0; k < scene.objs.size(); k++) {
-                // Return only value > 0
-                t = scene.objs[k]->intersect(ray);
-
-                // The closest intersection only
-                if (t < closestScalar && t > 0) {
-                    closestScalar = t;
-                    closestObj = scene.objs[k];
-                }
-            }
+    times.time("scene bvh", [&]() { scene.buildBVH(); });
+    cout << "Scene " << filename << " successfully loaded (" << report.sceneMBPerSecond() << " MB/s)." << endl;
 
-            // Color pixel at calculated intersection
-            if (closestScalar < INFINITY) {
-                // Compute intersection world coord
-                vec3 pointIntersect = ray.origin + (ray.direction * closestScalar);
-                vec3 result = vec3();    // Will contain the diffuse + specular contributions of the lights
-
-                // Cast shadow rays
-                float bias = 0.001f;
-                for (int l = 0; l < scene.lights.size(); l++) {
-                    Light *light = scene.lights[l];
-
-                    vec3 normal = closestObj->getNormalAt(pointIntersect);
-                    vec3 shadowDir = light->position - pointIntersect;
-                    Ray shadowRay = Ray(pointIntersect + normal * bias, normalize(shadowDir) );
-
-                    // Check if in shadow or not
-                    bool lit = true;
-                    for (int k = 0; k < scene.objs.size(); k++) {
-                        t = scene.objs[k]->intersect(shadowRay);
-
-                        // If we detect something in between intersection and light
-                        if (t < 1) {
-                            lit = false;
-                            break;
-                        }
-                    }
-
-                    // If still considered in the light
-                    if (lit) {
-                        // Computing Phong Model
-                        vec3 light_reflection = reflect(normalize(-shadowRay.direction), normalize(normal) );
-                        vec3 diffuseCoef = closestObj->material.diffuse * (float)glm::max(dot(normalize(normal), normalize(shadowRay.direction) ), 0.0);
-                        vec3 specularCoef = closestObj->material.specular * (float)pow(glm::max(dot(light_reflection, -ray.direction), 0.0), closestObj->material.shininess);
-
-                        // Diffuse
-                        result += light->diffuseColor * diffuseCoef;
-
-                        // Specular
-                        result += light->specularColor * specularCoef;
-                    }
-                }
-
-                // Adding ambient + result
-                pixelColor += closestObj->material.ambient + result;
-
-                // Scale and clamp color
-                pixelColor = pixelColor * 255.f;
-                clampColor(pixelColor);
-
-                // Paint the pixel
-                image(imgX,imgY,0) = pixelColor.x;
-                image(imgX,imgY,1) = pixelColor.y;
-                image(imgX,imgY,2) = pixelColor.z;
-            }
+    // Memory held by the triangles of the meshes, with their BVH
+    size_t triangles = 0, meshBytes = 0;
+    for (const Mesh &mesh : scene.meshes) {
+        triangles += mesh.size();
+        meshBytes += mesh.memoryUsage();
+    }
+    if (triangles > 0) {
+        cout << triangles << " triangles in " << scene.meshes.size() << " meshes, "
+             << (double) meshBytes / triangles << " bytes per triangle, " << scene.instances.size() << " instances" << endl;
+    }
 
+    // Render with every core unless told otherwise
+    int threads = options.threads > 0 ? options.threads : threadCount();
+    Renderer renderer(scene, options.width, options.height);
+    renderer.usePackets = options.packets && !options.comparePackets;
+    renderer.pixelOrder = options.rowOrder ? PixelOrder::ROWS : PixelOrder::Z_ORDER;
+    renderer.maxSamples = options.samples > 0 ? options.samples : (options.progressive ? 16 : 1);
+    renderer.threshold = options.threshold;
+    renderer.progressive = options.progressive;
+    renderer.timeBudget = options.timeBudget;
+    renderer.maxDepth = options.maxDepth;
+    scene.fastIntersection = options.fastIntersection && !options.compareFastIntersection;
+    report.width = renderer.width;
+    report.height = renderer.height;
+    report.threads = threads;
+    report.precision = scene.fastIntersection ? "single" : "double";
+    report.pixelOrder = options.rowOrder ? "rows" : "z";
+
+    // Nothing saved: the window renders the scene again after each move of the camera
+    if (options.interactive) {
+        InteractivePreview preview(renderer, threads);
+        preview.run("Render " + filename);
+        return true;
+    }
 
-        }
+    // Float formats are streamed to the file tile by tile, without the whole image in memory
+    string output = outputPath(options, filename);
+    if (scene.animation.frames > 0)
+        return renderSequence(renderer, output, filename, options, threads, report);
+    if (TiledImage::forPath(output, options.half)) {
+        RenderStats stats;
+        bool saved = renderTiledFile(renderer, output, filename, options, threads, times, stats);
+        report.counters = renderer.counters;
+        return saved;
     }
 
+    CImg<float> image(renderer.width, renderer.height, 1, 3, 0);
+    RenderStats stats = times.time("render", [&]() {
+        return options.workers > 0 ? WorkerPool(renderer, options.workers, threads).render(image)
+                                   : renderer.render(image, threads);
+    });
+    report.counters = renderer.counters;
+    if (renderer.maxSamples > 1) {
+        cout << (double) stats.samples / (renderer.width * renderer.height) << " samples per pixel on average, "
+             << stats.passes << " passes" << (stats.complete ? "" : ", cut by the time budget") << endl;
+    }
+
+    // Check the packet path against the scalar render
+    if (options.comparePackets && !comparePackets(renderer, image, threads))
+        return false;
+
+    // Check the single precision intersections against the double precision ones
+    if (options.compareFastIntersection && !compareFastIntersection(renderer, image, times.get("render"), threads))
+        return false;
+
     // Save img
-    image.save("render.bmp");
+    try {
+        PhaseTimes::Stopwatch stopwatch(times, "save");
+        image.save(output.c_str());
+    } catch (CImgException &e) {
+        cerr << "Unable to save " << output << ": " << e.what() << endl;
+        return false;
+    }
+    cout << "Render saved to " << output << endl;
 
     // Display img
-    CImgDisplay main_disp(image, "Render");
-    while (!main_disp.is_closed()) {
-        main_disp.wait();
+    if (options.display) {
+        CImgDisplay main_disp(image, "Render");
+        while (!main_disp.is_closed()) {
+            main_disp.wait();
+        }
     }
 
-    // End process
-    return 0;
+    return true;
 }
 
 
 /**
- * Parse scene file and create relative objects to build the scene
- * @param file
+ * Render tile by tile into a PFM or EXR file, each tile being written as soon as it is finished,
+ * then write a PNG preview next to it.
+ * The tiles written are recorded in <output>.tiles: a render stopped halfway starts again from the missing ones,
+ * as long as the scene file and the settings are the same.
+ *
+ * @param renderer
+ * @param output .pfm or .exr file
+ * @param sceneFile
+ * @param options
+ * @param threads
+ * @param times Gets the render time, and the one of the preview as "save"
+ * @param stats
+ * @param frame Frame of a sequence, -1 for a still image
+ * @return false if the file couldn't be written
  */
-void loadScene(ifstream &file, Scene &scene) {
-    string token;
-
-    // Until there is no more tokens
-    while (file >> token) {
-
-        if (token == "camera") {
-            for (int i = 0; i < 4; i++) {
-                file >> token;
-
-                if (token == "pos:") {
-                    scene.cam.position = readVec3(file);
-                } else if (token == "fov:") {
-                    file >> token;
-                    scene.cam.fov = std::stod(token) * (M_PI / 180);
-                } else if (token == "f:") {
-                    file >> token;
-                    scene.cam.focalLength = std::stof(token);
-                } else if (token == "a:") {
-                    file >> token;
-                    scene.cam.aspectRatio = std::stof(token);
-                }
-            }
+bool renderTiledFile(Renderer &renderer, const string &output, const string &sceneFile, const Options &options,
+                     int threads, PhaseTimes &times, RenderStats &stats, int frame) {
+    if (options.comparePackets || options.compareFastIntersection) {
+        cerr << "Comparing renders needs them in memory, not possible with " << output << endl;
+        return false;
+    }
+    if (options.progressive)
+        cout << "Tiles are rendered to their final sample count, the progressive refinement is left out" << endl;
+
+    vector<Tile> tiles = renderer.makeTiles();
+    string key = renderKey(renderer, sceneFile, options, frame);
+    unique_ptr<TiledImage> file = TiledImage::forPath(output, options.half);
+    TileJournal journal;
+    if (!journal.open(output + ".tiles", key, tiles.size()) ||
+        !file->open(output, renderer.width, renderer.height, renderer.tileSize, journal.count() > 0))
+        return false;
+
+    // The image is gone or of another size: its tiles have to be rendered again
+    if (!file->resumed() && journal.count() > 0 && !journal.restart(key))
+        return false;
+
+    vector<Tile> missing;
+    for (size_t t = 0; t < tiles.size(); t++) {
+        if (!journal.isDone(t))
+            missing.push_back(tiles[t]);
+    }
+    if (journal.count() > 0)
+        cout << "Resuming " << output << ": " << journal.count() << " of " << tiles.size() << " tiles already written" << endl;
+
+    auto writeTile = [&](const Tile &tile, const CImg<float> &image, const Window &window) {
+        if (file->writeTile(tile, image, window) && journal.markDone(renderer.tileIndex(tile)))
+            return true;
+        cerr << "Unable to write the tile at " << tile.x0 << ", " << tile.y0 << " to " << output << endl;
+        return false;
+    };
+    stats = times.time("render", [&]() {
+        return options.workers > 0 ? WorkerPool(renderer, options.workers, threads).renderTiles(missing, writeTile)
+                                   : renderer.renderTiles(missing, threads, writeTile);
+    });
+    if (!stats.complete)
+        return false;
+    if (renderer.maxSamples > 1) {
+        cout << (double) stats.samples / (renderer.width * renderer.height) << " samples per pixel on average" << endl;
+    }
 
+    // The preview reads the file back, a band of rows at a time
+    string preview = output.substr(0, output.find_last_of('.')) + ".png";
+    if (options.preview && !times.time("save", [&]() { return writePNGPreview(*file, preview); })) {
+        cerr << "Unable to write the preview " << preview << endl;
+        return false;
+    }
+    if (!file->close()) {
+        cerr << "Unable to write " << output << endl;
+        return false;
+    }
+    journal.remove();
 
-        } else if (token == "sphere") {
-            Sphere *sphere = new Sphere(vec3(0,0,0), 0);
-            Material mat;
-
-            for (int i = 0; i < 6; i++) {
-                file >> token;
-                if (token == "pos:") {
-                    sphere->position = readVec3(file);
-                } else if (token == "rad:") {
-                    file >> token;
-                    sphere->radius = std::stod(token);
-                } else if (token == "amb:") {
-                    mat.ambient = readVec3(file);
-                } else if (token == "dif:") {
-                    mat.diffuse = readVec3(file);
-                } else if (token == "spe:") {
-                    mat.specular = readVec3(file);
-                } else if (token == "shi:") {
-                    file >> token;
-                    mat.shininess = std::stof(token);
-                }
-            }
-            sphere->material = mat;
-
-            // Add to scene
-            scene.objs.push_back(sphere);
-
-        } else if (token == "plane") {
-            Plane *plane = new Plane();
-            Material mat;
-
-            for (int i = 0; i < 6; i++) {
-                file >> token;
-                if (token == "pos:") {
-                    plane->position = readVec3(file);
-                } else if (token == "nor:") {
-                    plane->normal = readVec3(file);
-                } else if (token == "amb:") {
-                    mat.ambient = readVec3(file);
-                } else if (token == "dif:") {
-                    mat.diffuse = readVec3(file);
-                } else if (token == "spe:") {
-                    mat.specular = readVec3(file);
-                } else if (token == "shi:") {
-                    file >> token;
-                    mat.shininess = std::stof(token);
-                }
-            }
-            plane->material = mat;
-
-            // Add to scene
-            scene.objs.push_back(plane);
-
-        } else if (token == "light") {
-            Light *light = new Light();
-
-            for (int i = 0; i < 3; i++) {
-                file >> token;
-                if (token == "pos:") {
-                    light->position = readVec3(file);
-                } else if (token == "dif:") {
-                    light->diffuseColor = readVec3(file);
-                } else if (token == "spe:") {
-                    light->specularColor = readVec3(file);
-                }
-            }
+    cout << "Render saved to " << output << (options.preview ? " with its preview " + preview : "") << endl;
+    if (options.display)
+        cout << "Renders streamed to a file aren't displayed" << endl;
+    return true;
+}
 
-            // Add to scene
-            scene.lights.push_back(light);
-        } else if(token == "mesh"){
-            Mesh mesh;
-            Material mat;
-
-            for(int i=0; i<5; i++){
-                file >> token;
-
-                if(token == "file:"){
-                    file >> token;
-                    // Load OBJ and create triangles for the mesh
-                    string path = "scenes/";
-                    path.append(token);
-
-                    vector<vec3> vertices;
-                    vector<vec3> normals;
-                    vector<vec2> UVs;
-
-                    // Load the OBJ data
-                    loadOBJ(path.c_str(), vertices, normals, UVs);
-
-                    // Build triangle out of the vertices data
-                    for(int t=0; t<vertices.size(); t+=3){
-                        Triangle *tri = new Triangle(vertices[t], vertices[t+1], vertices[t+2]);
-                        mesh.triangles.push_back(tri);
-                    }
-
-
-                } else if (token == "amb:") {
-                    mat.ambient = readVec3(file);
-                } else if (token == "dif:") {
-                    mat.diffuse = readVec3(file);
-                } else if (token == "spe:") {
-                    mat.specular = readVec3(file);
-                } else if (token == "shi:") {
-                    file >> token;
-                    mat.shininess = std::stof(token);
-                }
-            }
+/**
+ * Render each frame of a keyframed scene to its own file, the output name numbered with the frame.
+ * The scene is loaded and its BVH built once: between frames, the animated parts are moved and the BVH refitted.
+ * Bitmaps are saved by a background thread, while the next frame is set up and rendered into the other buffer.
+ *
+ * @param renderer
+ * @param output Numbered for each frame
+ * @param sceneFile
+ * @param options
+ * @param threads
+ * @param report Gets the times and the counters of all the frames
+ * @return false if a frame couldn't be saved
+ */
+bool renderSequence(Renderer &renderer, const string &output, const string &sceneFile, const Options &options,
+                    int threads, SceneReport &report) {
+    if (options.comparePackets || options.compareFastIntersection) {
+        cerr << "Renders aren't compared in a sequence" << endl;
+        return false;
+    }
 
-            // Assign material to all triangles
-            // TODO: structure this in a better way
-            for(int k=0; k<mesh.triangles.size(); k++){
-                mesh.triangles[k]->material = mat;
-                scene.objs.push_back(mesh.triangles[k]);
-            }
+    Scene &scene = renderer.scene;
+    PhaseTimes &times = report.times;
+    bool tiled = TiledImage::forPath(output, options.half) != nullptr;
+    int frames = scene.animation.frames;
+
+    // Frame f is rendered into one buffer while frame f - 1 is saved from the other
+    CImg<float> images[2];
+    thread writer;
+    atomic<bool> saved(true);
+    double saveSeconds = 0;
+    auto waitWriter = [&]() {
+        if (writer.joinable()) writer.join();
+    };
+
+    for (int f = 0; f < frames && saved; f++) {
+        times.time("frame setup", [&]() { scene.setFrame(f); });
+        string frameOutput = framePath(output, f);
+
+        if (tiled) {
+            RenderStats stats;
+            saved = renderTiledFile(renderer, frameOutput, sceneFile, options, threads, times, stats, f);
+            report.counters.add(renderer.counters);
+            continue;
         }
+
+        CImg<float> &image = images[f % 2];
+        image.assign(renderer.width, renderer.height, 1, 3, 0);
+        times.time("render", [&]() {
+            return options.workers > 0 ? WorkerPool(renderer, options.workers, threads).render(image)
+                                       : renderer.render(image, threads);
+        });
+        report.counters.add(renderer.counters);
+
+        waitWriter();
+        writer = thread([&image, frameOutput, &saved, &saveSeconds]() {
+            auto start = chrono::steady_clock::now();
+            try {
+                image.save(frameOutput.c_str());
+            } catch (CImgException &e) {
+                cerr << "Unable to save " << frameOutput << ": " << e.what() << endl;
+                saved = false;
+            }
+            saveSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        });
     }
+    waitWriter();
+    times.add("save", saveSeconds);
+
+    if (!saved)
+        return false;
+    cout << frames << " frames saved to " << framePath(output, 0) << " to " << framePath(output, frames - 1) << endl;
+    if (options.display)
+        cout << "Sequences aren't displayed" << endl;
+    return true;
 }
 
 /**
- * Read the next 3 tokens, considered as numerical values, and return a Vec3 out of them
- * @param file
+ * Describe what makes the pixels of a render, for a resumed render to only reuse the tiles of the same one
+ * @param renderer
+ * @param sceneFile Hashed
+ * @param options
+ * @param frame Frame of a sequence, -1 for a still image
  * @return
  */
-vec3 readVec3(ifstream &file) {
-    double x, y, z;
-    file >> x;
-    file >> y;
-    file >> z;
-    return {x, y, z};
+string renderKey(const Renderer &renderer, const string &sceneFile, const Options &options, int frame) {
+    // FNV-1a of the scene file
+    uint64_t hash = 1469598103934665603ull;
+    ifstream file(sceneFile, ios::binary);
+    char c;
+    while (file.get(c)) {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ull;
+    }
+
+    ostringstream key;
+    key << renderer.width << "x" << renderer.height << " tile " << renderer.tileSize
+        << " samples " << renderer.maxSamples << " threshold " << renderer.threshold << " depth " << renderer.maxDepth
+        << (renderer.usePackets ? " packets" : "") << (renderer.scene.fastIntersection ? " fast" : "")
+        << (options.half ? " half" : "") << (frame >= 0 ? " frame " + to_string(frame) : "") << " scene " << hex << hash;
+    return key.str();
 }
 
+
+/**
+ * Render again with packets, and compare each pixel with the scalar render.
+ * Pixels on silhouettes can flip to the neighbouring object with the single precision of the packets,
+ * so a small share of them is allowed past the tolerance.
+ *
+ * @param renderer
+ * @param reference Scalar render
+ * @param threads
+ * @return false if the renders disagree
+ */
+bool comparePackets(Renderer &renderer, const CImg<float> &reference, int threads) {
+    CImg<float> packetImage(renderer.width, renderer.height, 1, 3, 0);
+    renderer.usePackets = true;
+    renderer.render(packetImage, threads);
+    renderer.usePackets = false;
+
+    return compareRenders(reference, packetImage, string("Packets (") + simdName() + ") vs scalar");
+}
+
+/**
+ * Render again with the single precision intersections, compare each pixel with the double precision render,
+ * and report the speedup
+ *
+ * @param renderer
+ * @param reference Double precision render
+ * @param referenceSeconds Time it took
+ * @param threads
+ * @return false if the renders disagree
+ */
+bool compareFastIntersection(Renderer &renderer, const CImg<float> &reference, double referenceSeconds, int threads) {
+    CImg<float> fastImage(renderer.width, renderer.height, 1, 3, 0);
+    PhaseTimes times;
+    renderer.scene.fastIntersection = true;
+    times.time("render", [&]() { renderer.render(fastImage, threads); });
+    renderer.scene.fastIntersection = false;
+
+    cout << "Fast intersection: " << times.get("render") * 1000 << " ms against " << referenceSeconds * 1000
+         << " ms, x" << referenceSeconds / times.get("render") << endl;
+    return compareRenders(reference, fastImage, "Fast intersection vs double");
+}
+
+/**
+ * Compare two renders of the same scene pixel by pixel.
+ * A small share of the pixels is allowed past the tolerance, for silhouettes flipping to the neighbouring object.
+ *
+ * @param reference
+ * @param other
+ * @param label Printed with the result
+ * @return false if the renders disagree
+ */
+bool compareRenders(const CImg<float> &reference, const CImg<float> &other, const string &label) {
+    const float tolerance = 2.f;            // Per channel, on the 0-255 scale
+    const double allowedOutliers = 0.001;   // Share of pixels allowed past the tolerance
+
+    float maxDiff = 0;
+    int outliers = 0;
+    for (int y = 0; y < reference.height(); y++) {
+        for (int x = 0; x < reference.width(); x++) {
+            float diff = 0;
+            for (int c = 0; c < 3; c++)
+                diff = glm::max(diff, std::fabs(other(x, y, 0, c) - reference(x, y, 0, c)));
+
+            maxDiff = glm::max(maxDiff, diff);
+            if (diff > tolerance)
+                outliers++;
+        }
+    }
+
+    double share = (double) outliers / (reference.width() * reference.height());
+    bool agree = share <= allowedOutliers;
+    cout << label << ": max difference " << maxDiff
+         << ", " << outliers << " pixels past " << tolerance << " (" << share * 100 << "%) -> "
+         << (agree ? "OK" : "FAILED") << endl;
+    return agree;
+}